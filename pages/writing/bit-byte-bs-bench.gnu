@@ -0,0 +1,57 @@
+# bit-byte-bs-bench.gnu
+# Plots bit-byte-bs-bench.dat, written by `./bit-byte-bs bench`.
+# One panel per variant, ns/field by field width for each read method.
+
+set terminal svg size 900,700 background "white" font "Arial"
+set border 3
+set tics nomirror
+set xtics 8
+set mxtics 2
+
+set xlabel "field width (bits)"
+set ylabel "ns / field" rotate by 90
+
+set xrange [0:65]
+set yrange [0:*]
+
+# Styles
+set style line 1 lc rgb "#0066cc" lt 1 lw 2 pt 7 ps 0.4
+set style line 2 lc rgb "#228B22" lt 1 lw 2 pt 7 ps 0.4
+set style line 3 lc rgb "#e67e22" lt 2 lw 2 pt 7 ps 0.4
+set style line 4 lc rgb "#8e44ad" lt 2 lw 2 pt 7 ps 0.4
+
+set key top left
+set datafile missing "nan"
+
+data = 'bit-byte-bs-bench.dat'
+set multiplot layout 2,2
+
+set title "LE, LSB0"
+plot \
+    data index 0 using 1:2 with linespoints ls 1 title "orig, random", \
+    data index 0 using 1:3 with linespoints ls 2 title "fast, random", \
+    data index 0 using 1:4 with linespoints ls 3 title "fast, sequential", \
+    data index 0 using 1:5 with linespoints ls 4 title "cursor, sequential"
+
+set title "LE, MSB0"
+plot \
+    data index 1 using 1:2 with linespoints ls 1 title "orig, random", \
+    data index 1 using 1:3 with linespoints ls 2 title "fast, random", \
+    data index 1 using 1:4 with linespoints ls 3 title "fast, sequential", \
+    data index 1 using 1:5 with linespoints ls 4 title "cursor, sequential"
+
+set title "BE, LSB0"
+plot \
+    data index 2 using 1:2 with linespoints ls 1 title "orig, random", \
+    data index 2 using 1:3 with linespoints ls 2 title "fast, random", \
+    data index 2 using 1:4 with linespoints ls 3 title "fast, sequential", \
+    data index 2 using 1:5 with linespoints ls 4 title "cursor, sequential"
+
+set title "BE, MSB0"
+plot \
+    data index 3 using 1:2 with linespoints ls 1 title "orig, random", \
+    data index 3 using 1:3 with linespoints ls 2 title "fast, random", \
+    data index 3 using 1:4 with linespoints ls 3 title "fast, sequential", \
+    data index 3 using 1:5 with linespoints ls 4 title "cursor, sequential"
+
+unset multiplot
@@ -144,203 +144,649 @@ void write_bits_le_lsb0(u8 *buf, u32 start, u8 len, u64 value) {
   }
 }
 
+/* NOTE(lf) Word-at-a-time versions of the readers above. Each one does a
+   single unaligned 64-bit load at the start byte and extracts the field with
+   shifts and masks, instead of a loop over bytes. Compared to the originals:
+   - len can be anything from 1 to 64.
+   - start is a 64-bit bit offset, so buffers are not limited to 256 bytes.
+   - Reads near the end of buf only touch bytes below size.
+   A field can only span 9 bytes when len > 56, that rare case is split into
+   two loads at a byte boundary.
+*/
+#include <string.h> // memcpy
+
+static inline u64 bits_mask(u32 len) { // 1 <= len <= 64
+  return ~0ull >> (64 - len);
+}
+
+static inline u64 load_le64(u8 *buf, u64 size, u64 i) {
+  u64 w = 0;
+  if (i + 8 <= size) {
+    memcpy(&w, buf + i, 8);
+  } else if (i < size) {
+    memcpy(&w, buf + i, size - i);
+  }
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  w = __builtin_bswap64(w);
+#endif
+  return w;
+}
+
+static inline u64 load_be64(u8 *buf, u64 size, u64 i) {
+  return __builtin_bswap64(load_le64(buf, size, i));
+}
+
+/* Extract a field starting ir bits into the first byte of w, ir + len <= 64.
+   For the le variants byte k of the buffer is bits [8k, 8k+8) of w, for the
+   be variants it is bits [56-8k, 64-8k).
+*/
+static inline u64 bits_extract_le_lsb0(u64 w, u32 ir, u32 len) {
+  return (w >> ir) & bits_mask(len);
+}
+
+static inline u64 bits_extract_be_msb0(u64 w, u32 ir, u32 len) {
+  return (w << ir) >> (64 - len);
+}
+
+static inline u64 bits_extract_le_msb0(u64 w, u32 ir, u32 len) {
+  u32 e = ir + len;
+  if (e <= 8) {
+    return (w >> (8 - e)) & bits_mask(len);
+  }
+  u32 last = (e - 1) >> 3;
+  u32 r = e - 8*last;
+  u32 n = 8 - ir;
+  u32 mid = 8*(last - 1);
+  u64 v = w & bits_mask(n);
+  v |= ((w >> 8) & ((1ull << mid) - 1)) << n;
+  v |= ((w >> (8*last + 8 - r)) & bits_mask(r)) << (n + mid);
+  return v;
+}
+
+static inline u64 bits_extract_be_lsb0(u64 w, u32 ir, u32 len) {
+  u32 e = ir + len;
+  if (e <= 8) {
+    return (w >> (56 + ir)) & bits_mask(len);
+  }
+  u32 last = (e - 1) >> 3;
+  u32 r = e - 8*last;
+  u32 n = 8 - ir;
+  u64 v = (w >> (56 + ir)) << (len - n);
+  v |= ((w >> (64 - 8*last)) & ((1ull << 8*(last - 1)) - 1)) << r;
+  v |= (w >> (56 - 8*last)) & bits_mask(r);
+  return v;
+}
+
+u64 read_bits_le_lsb0_fast(u8 *buf, u64 size, u64 start, u32 len) {
+  u64 i = start >> 3;
+  u32 ir = start & 0x7;
+  if (ir + len > 64) {
+    u32 n = 56 - ir;
+    u64 lo = bits_extract_le_lsb0(load_le64(buf, size, i), ir, n);
+    return lo | (bits_extract_le_lsb0(load_le64(buf, size, i + 7), 0, len - n) << n);
+  }
+  return bits_extract_le_lsb0(load_le64(buf, size, i), ir, len);
+}
+
+u64 read_bits_le_msb0_fast(u8 *buf, u64 size, u64 start, u32 len) {
+  u64 i = start >> 3;
+  u32 ir = start & 0x7;
+  if (ir + len > 64) {
+    u32 n = 56 - ir;
+    u64 lo = bits_extract_le_msb0(load_le64(buf, size, i), ir, n);
+    return lo | (bits_extract_le_msb0(load_le64(buf, size, i + 7), 0, len - n) << n);
+  }
+  return bits_extract_le_msb0(load_le64(buf, size, i), ir, len);
+}
+
+u64 read_bits_be_lsb0_fast(u8 *buf, u64 size, u64 start, u32 len) {
+  u64 i = start >> 3;
+  u32 ir = start & 0x7;
+  if (ir + len > 64) {
+    u32 n = 56 - ir;
+    u64 hi = bits_extract_be_lsb0(load_be64(buf, size, i), ir, n);
+    return (hi << (len - n)) | bits_extract_be_lsb0(load_be64(buf, size, i + 7), 0, len - n);
+  }
+  return bits_extract_be_lsb0(load_be64(buf, size, i), ir, len);
+}
+
+u64 read_bits_be_msb0_fast(u8 *buf, u64 size, u64 start, u32 len) {
+  u64 i = start >> 3;
+  u32 ir = start & 0x7;
+  if (ir + len > 64) {
+    u32 n = 56 - ir;
+    u64 hi = bits_extract_be_msb0(load_be64(buf, size, i), ir, n);
+    return (hi << (len - n)) | bits_extract_be_msb0(load_be64(buf, size, i + 7), 0, len - n);
+  }
+  return bits_extract_be_msb0(load_be64(buf, size, i), ir, len);
+}
+
+static inline void store_le64(u8 *buf, u64 size, u64 i, u64 w) {
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  w = __builtin_bswap64(w);
+#endif
+  if (i + 8 <= size) {
+    memcpy(buf + i, &w, 8);
+  } else if (i < size) {
+    memcpy(buf + i, &w, size - i);
+  }
+}
+
+static inline void store_be64(u8 *buf, u64 size, u64 i, u64 w) {
+  store_le64(buf, size, i, __builtin_bswap64(w));
+}
+
+// Inverse of bits_extract_*, returns w with the field replaced by value.
+static inline u64 bits_deposit_le_lsb0(u64 w, u32 ir, u32 len, u64 value) {
+  u64 m = bits_mask(len) << ir;
+  return (w & ~m) | ((value << ir) & m);
+}
+
+static inline u64 bits_deposit_be_msb0(u64 w, u32 ir, u32 len, u64 value) {
+  u32 sh = 64 - ir - len;
+  u64 m = bits_mask(len) << sh;
+  return (w & ~m) | ((value << sh) & m);
+}
+
+static inline u64 bits_deposit_le_msb0(u64 w, u32 ir, u32 len, u64 value) {
+  u32 e = ir + len;
+  if (e <= 8) {
+    u64 m = bits_mask(len) << (8 - e);
+    return (w & ~m) | ((value << (8 - e)) & m);
+  }
+  u32 last = (e - 1) >> 3;
+  u32 r = e - 8*last;
+  u32 n = 8 - ir;
+  u32 mid = 8*(last - 1);
+  u32 sh = 8*last + 8 - r;
+  u64 m = bits_mask(n) | (((1ull << mid) - 1) << 8) | (bits_mask(r) << sh);
+  u64 v = value & bits_mask(n);
+  v |= ((value >> n) & ((1ull << mid) - 1)) << 8;
+  v |= ((value >> (n + mid)) & bits_mask(r)) << sh;
+  return (w & ~m) | v;
+}
+
+static inline u64 bits_deposit_be_lsb0(u64 w, u32 ir, u32 len, u64 value) {
+  u32 e = ir + len;
+  if (e <= 8) {
+    u64 m = bits_mask(len) << (56 + ir);
+    return (w & ~m) | ((value << (56 + ir)) & m);
+  }
+  u32 last = (e - 1) >> 3;
+  u32 r = e - 8*last;
+  u32 n = 8 - ir;
+  u32 mid = 8*(last - 1);
+  u64 m = (bits_mask(n) << (56 + ir)) | (((1ull << mid) - 1) << (64 - 8*last)) | (bits_mask(r) << (56 - 8*last));
+  u64 v = ((value >> (len - n)) & bits_mask(n)) << (56 + ir);
+  v |= ((value >> r) & ((1ull << mid) - 1)) << (64 - 8*last);
+  v |= (value & bits_mask(r)) << (56 - 8*last);
+  return (w & ~m) | v;
+}
+
+void write_bits_le_lsb0_fast(u8 *buf, u64 size, u64 start, u32 len, u64 value) {
+  u64 i = start >> 3;
+  u32 ir = start & 0x7;
+  if (ir + len > 64) {
+    u32 n = 56 - ir;
+    store_le64(buf, size, i, bits_deposit_le_lsb0(load_le64(buf, size, i), ir, n, value));
+    store_le64(buf, size, i + 7, bits_deposit_le_lsb0(load_le64(buf, size, i + 7), 0, len - n, value >> n));
+    return;
+  }
+  store_le64(buf, size, i, bits_deposit_le_lsb0(load_le64(buf, size, i), ir, len, value));
+}
+
+void write_bits_le_msb0_fast(u8 *buf, u64 size, u64 start, u32 len, u64 value) {
+  u64 i = start >> 3;
+  u32 ir = start & 0x7;
+  if (ir + len > 64) {
+    u32 n = 56 - ir;
+    store_le64(buf, size, i, bits_deposit_le_msb0(load_le64(buf, size, i), ir, n, value));
+    store_le64(buf, size, i + 7, bits_deposit_le_msb0(load_le64(buf, size, i + 7), 0, len - n, value >> n));
+    return;
+  }
+  store_le64(buf, size, i, bits_deposit_le_msb0(load_le64(buf, size, i), ir, len, value));
+}
+
+void write_bits_be_lsb0_fast(u8 *buf, u64 size, u64 start, u32 len, u64 value) {
+  u64 i = start >> 3;
+  u32 ir = start & 0x7;
+  if (ir + len > 64) {
+    u32 n = 56 - ir;
+    store_be64(buf, size, i, bits_deposit_be_lsb0(load_be64(buf, size, i), ir, n, value >> (len - n)));
+    store_be64(buf, size, i + 7, bits_deposit_be_lsb0(load_be64(buf, size, i + 7), 0, len - n, value));
+    return;
+  }
+  store_be64(buf, size, i, bits_deposit_be_lsb0(load_be64(buf, size, i), ir, len, value));
+}
+
+void write_bits_be_msb0_fast(u8 *buf, u64 size, u64 start, u32 len, u64 value) {
+  u64 i = start >> 3;
+  u32 ir = start & 0x7;
+  if (ir + len > 64) {
+    u32 n = 56 - ir;
+    store_be64(buf, size, i, bits_deposit_be_msb0(load_be64(buf, size, i), ir, n, value >> (len - n)));
+    store_be64(buf, size, i + 7, bits_deposit_be_msb0(load_be64(buf, size, i + 7), 0, len - n, value));
+    return;
+  }
+  store_be64(buf, size, i, bits_deposit_be_msb0(load_be64(buf, size, i), ir, len, value));
+}
+
+/* NOTE(lf) Cursors for reading or writing consecutive fields. Each variant
+   gets its own type so streams can't be mixed up. The cursor keeps the
+   64-bit word at `base` and only reloads when a field runs past it, so a
+   stream of small fields costs about one load per 7 bytes instead of one
+   per field. Writers keep the same word and store it back when moving on,
+   call bit_flush_* after the last write.
+
+     BitCursor_le_lsb0 c = bit_cursor_le_lsb0(buf, sizeof(buf), 0);
+     u8 width[3] = { 11, 1, 16 };
+     u64 field[3];
+     bit_read_n_le_lsb0(&c, field, width, 3);
+*/
+#define BIT_CURSOR(v, load, store, shift, unshift, keep)                      \
+typedef struct BitCursor_##v BitCursor_##v;                                   \
+struct BitCursor_##v {                                                        \
+  u8 *buf;                                                                    \
+  u64 size;                                                                   \
+  u64 pos;                                                                    \
+  u64 base;                                                                   \
+  u64 w;                                                                      \
+  u32 dirty;                                                                  \
+};                                                                            \
+                                                                              \
+BitCursor_##v bit_cursor_##v(u8 *buf, u64 size, u64 start) {                  \
+  BitCursor_##v c = { buf, size, start, start >> 3, 0, 0 };                   \
+  c.w = load(buf, size, c.base);                                              \
+  return c;                                                                   \
+}                                                                             \
+                                                                              \
+void bit_flush_##v(BitCursor_##v *c) {                                        \
+  if (c->dirty) {                                                             \
+    store(c->buf, c->size, c->base, c->w);                                    \
+    c->dirty = 0;                                                             \
+  }                                                                           \
+}                                                                             \
+                                                                              \
+static inline u64 bit_read_##v(BitCursor_##v *c, u32 len) {                   \
+  u64 i = c->pos >> 3;                                                        \
+  u32 ir = c->pos & 0x7;                                                      \
+  u64 value;                                                                  \
+  if (ir + len > 64) {                                                        \
+    bit_flush_##v(c);                                                         \
+    value = read_bits_##v##_fast(c->buf, c->size, c->pos, len);               \
+  } else {                                                                    \
+    if (i + ((ir + len + 7) >> 3) > c->base + 8) {                            \
+      bit_flush_##v(c);                                                       \
+      c->base = i;                                                            \
+      c->w = load(c->buf, c->size, i);                                        \
+    }                                                                         \
+    value = bits_extract_##v(c->w shift (8*(i - c->base)), ir, len);          \
+  }                                                                           \
+  c->pos += len;                                                              \
+  return value;                                                               \
+}                                                                             \
+                                                                              \
+static inline void bit_write_##v(BitCursor_##v *c, u32 len, u64 value) {      \
+  u64 i = c->pos >> 3;                                                        \
+  u32 ir = c->pos & 0x7;                                                      \
+  if (ir + len > 64) {                                                        \
+    bit_flush_##v(c);                                                         \
+    write_bits_##v##_fast(c->buf, c->size, c->pos, len, value);               \
+    c->w = load(c->buf, c->size, c->base);                                    \
+  } else {                                                                    \
+    if (i + ((ir + len + 7) >> 3) > c->base + 8) {                            \
+      bit_flush_##v(c);                                                       \
+      c->base = i;                                                            \
+      c->w = load(c->buf, c->size, i);                                        \
+    }                                                                         \
+    u32 sh = 8*(i - c->base);                                                 \
+    u64 sub = bits_deposit_##v(c->w shift sh, ir, len, value);                \
+    c->w = keep(c->w, sh) | (sub unshift sh);                                 \
+    c->dirty = 1;                                                             \
+  }                                                                           \
+  c->pos += len;                                                              \
+}                                                                             \
+                                                                              \
+void bit_read_n_##v(BitCursor_##v *c, u64 *field, u8 *width, u32 n) {         \
+  for (u32 k = 0; k < n; k++) {                                               \
+    field[k] = bit_read_##v(c, width[k]);                                     \
+  }                                                                           \
+}                                                                             \
+                                                                              \
+void bit_write_n_##v(BitCursor_##v *c, u64 *field, u8 *width, u32 n) {        \
+  for (u32 k = 0; k < n; k++) {                                               \
+    bit_write_##v(c, width[k], field[k]);                                     \
+  }                                                                           \
+}
+
+// bytes of w before the field, which a write must leave alone
+#define KEEP_LE(w, sh) ((w) & ((1ull << (sh)) - 1))
+#define KEEP_BE(w, sh) ((w) & ~(~0ull >> (sh)))
+
+BIT_CURSOR(le_lsb0, load_le64, store_le64, >>, <<, KEEP_LE)
+BIT_CURSOR(le_msb0, load_le64, store_le64, >>, <<, KEEP_LE)
+BIT_CURSOR(be_lsb0, load_be64, store_be64, <<, >>, KEEP_BE)
+BIT_CURSOR(be_msb0, load_be64, store_be64, <<, >>, KEEP_BE)
+
 #include <stdio.h>
-#include <string.h> // memcpy, memset
-int main() {
-    u8 buf[16];
-
-    /* NOTE(lf) the code to generate the different bit patterns
-      for these tests really sucks for most of the variants.
-    */
-
-    for (u32 i = 1; i <= 16; i++) { // BE MSB0
-      for (u32 s = 0; s < 16; s++) {
-        memset(buf, 0xFF, sizeof(buf));
-
-        u32 V;
-        V = (1<<i)-1; // full bit pattern
-        // V = 1<<(i-1); // msb only
-        // V = 0xAAAA >> (16-i); // every other bit, msb=1
-        // V = 0xCCCC >> (16-i); // every 2 bits, msb=1
-        // V = 0x3333 >> (16-i); // every 2 bits, msb=0
-        // V = 0x5555 >> (16-i); // every other bit, msb=0
-
-        u32 Vf = V | ((0xFFFF << i) & 0xFFFF);
-        u32 B = 0;
-        for (u32 b = 0; b < i; b++) {
-          u32 n = 8*(3-(b>>3)) + (7-(b&7));
-          B |= !!(Vf & (1<<(i-(b+1)))) << n;
-        }
-        B = B >> s;
-        memcpy(buf, &B, sizeof(B));
-        for (u32 b = 0; b < sizeof(B)/2; b++) {
-          u8 t = buf[b];
-          buf[b] = buf[sizeof(B)-1-b];
-          buf[sizeof(B)-1-b] = t;
-        }
-        memcpy(buf+12, buf, sizeof(B));
-        memset(buf, 0, sizeof(B));
+#include <stdlib.h> // rand
+#include <time.h>
+#include <math.h> // NAN
+
+/* NOTE(lf) Test and benchmark harness.
+     ./bit-byte-bs         check every variant against a bit-by-bit reference
+     ./bit-byte-bs bench   also write ns/field and GB/s to bit-byte-bs-bench.dat,
+                           see bit-byte-bs-bench.gnu for plotting
+*/
+enum Variant { LE_LSB0, LE_MSB0, BE_LSB0, BE_MSB0, VARIANTS };
+const char *variant_name[VARIANTS] = { "LE, LSB0", "LE, MSB0", "BE, LSB0", "BE, MSB0" };
+
+/* Stream bit k is bit (k & 7) of byte k >> 3 for LSB0, bit 7 - (k & 7) for
+   MSB0. Within each byte the field bits keep their order, and the per-byte
+   runs are placed first-byte-lowest for LE, first-byte-highest for BE.
+*/
+u32 ref_value_bit(enum Variant var, u32 len, u32 j, u32 run, u32 k) {
+  switch (var) {
+    case LE_LSB0: return j + k;
+    case LE_MSB0: return j + run - 1 - k;
+    case BE_LSB0: return len - j - run + k;
+    default:      return len - 1 - (j + k);
+  }
+}
 
-        u32 S = s + 12*8;
+u64 read_bits_ref(u8 *buf, u64 start, u32 len, enum Variant var) {
+  u64 v = 0;
+  for (u32 j = 0; j < len; ) {
+    u64 p = start + j;
+    u32 run = 8 - (p & 7) < len - j? 8 - (p & 7) : len - j;
+    for (u32 k = 0; k < run; k++) {
+      u64 q = p + k;
+      u32 bit = (var == LE_MSB0 || var == BE_MSB0)? 7 - (q & 7) : q & 7;
+      v |= (u64) ((buf[q >> 3] >> bit) & 1) << ref_value_bit(var, len, j, run, k);
+    }
+    j += run;
+  }
+  return v;
+}
 
-        u32 y = read_bits_be_msb0(buf, S, i);
-        if (y != V) {
-          y = read_bits_be_msb0(buf, S, i);
-        }
-        if (y != V) {
-          printf("(BE, MSB0) %08X : %X ? %X \n", B, V, y);
-        }
-      }
+void write_bits_ref(u8 *buf, u64 start, u32 len, u64 value, enum Variant var) {
+  for (u32 j = 0; j < len; ) {
+    u64 p = start + j;
+    u32 run = 8 - (p & 7) < len - j? 8 - (p & 7) : len - j;
+    for (u32 k = 0; k < run; k++) {
+      u64 q = p + k;
+      u32 bit = (var == LE_MSB0 || var == BE_MSB0)? 7 - (q & 7) : q & 7;
+      u8 b = (value >> ref_value_bit(var, len, j, run, k)) & 1;
+      buf[q >> 3] = (buf[q >> 3] & ~(1 << bit)) | (b << bit);
     }
-    printf("\n");
-
-    for (u32 i = 1; i <= 16; i++) { // BE LSB0
-      for (u32 s = 0; s < 16; s++) {
-        memset(buf, 0xFF, sizeof(buf));
-
-        u32 V;
-        // V = (1<<i)-1; // full bit pattern
-        // V = 1<<(i-1); // msb only
-        // V = 0xAAAA >> (16-i); // every other bit, msb=1
-        // V = 0xCCCC >> (16-i); // every 2 bits, msb=1
-        // V = 0x3333 >> (16-i); // every 2 bits, msb=0
-        V = 0x5555 >> (16-i); // every other bit, msb=0
-
-        u32 Vf = V | ((0xFFFF << i) & 0xFFFF);
-        u32 B = 0;
-        {
-          u8 j = s >> 3;
-          u8 ir = s & 0x7;
-          u8 n = 0;
-          if (ir) {
-            n = 8-ir;
-            if (i >= n) {
-              buf[j++] = (Vf >> (i-n)) << ir;
-            } else {
-              buf[j++] = Vf << ir;
-            }
-          }
-          while ((n+8u) < i) {
-            n += 8;
-            buf[j++] = (Vf >> (i-n)) & 0xFF;
+    j += run;
+  }
+}
+
+u64 rand64(void) {
+  return ((u64) rand() << 42) ^ ((u64) rand() << 21) ^ (u64) rand();
+}
+
+#define PATTERNS 8
+u64 pattern(u32 kind, u32 len) {
+  u64 v;
+  switch (kind) {
+    case 0:  v = ~0ull; break;                        // full bit pattern
+    case 1:  v = 1ull << (len - 1); break;            // msb only
+    case 2:  v = 1; break;                            // lsb only
+    case 3:  v = 0xAAAAAAAAAAAAAAAA >> (64 - len); break; // every other bit, msb=1
+    case 4:  v = 0x5555555555555555 >> (64 - len); break; // every other bit, msb=0
+    case 5:  v = 0xCCCCCCCCCCCCCCCC >> (64 - len); break; // every 2 bits, msb=1
+    case 6:  v = 0x3333333333333333 >> (64 - len); break; // every 2 bits, msb=0
+    default: v = rand64(); break;
+  }
+  return v & bits_mask(len);
+}
+
+// The originals shift bytes as int and index with a u8, so they are only
+// checked where that is well defined.
+#define ORIG_MAX_LEN 24
+#define ORIG_MAX_BYTE 200
+
+u64 read_orig(enum Variant var, u8 *buf, u64 start, u32 len) {
+  switch (var) {
+    case LE_LSB0: return read_bits_le_lsb0(buf, start, len);
+    case LE_MSB0: return read_bits_le_msb0(buf, start, len);
+    case BE_LSB0: return read_bits_be_lsb0(buf, start, len);
+    default:      return read_bits_be_msb0(buf, start, len);
+  }
+}
+
+u64 read_fast(enum Variant var, u8 *buf, u64 size, u64 start, u32 len) {
+  switch (var) {
+    case LE_LSB0: return read_bits_le_lsb0_fast(buf, size, start, len);
+    case LE_MSB0: return read_bits_le_msb0_fast(buf, size, start, len);
+    case BE_LSB0: return read_bits_be_lsb0_fast(buf, size, start, len);
+    default:      return read_bits_be_msb0_fast(buf, size, start, len);
+  }
+}
+
+void write_fast(enum Variant var, u8 *buf, u64 size, u64 start, u32 len, u64 value) {
+  switch (var) {
+    case LE_LSB0: write_bits_le_lsb0_fast(buf, size, start, len, value); break;
+    case LE_MSB0: write_bits_le_msb0_fast(buf, size, start, len, value); break;
+    case BE_LSB0: write_bits_be_lsb0_fast(buf, size, start, len, value); break;
+    default:      write_bits_be_msb0_fast(buf, size, start, len, value); break;
+  }
+}
+
+#define CURSOR_IO(v)                                                          \
+void cursor_read_##v(u8 *buf, u64 size, u64 start,                            \
+                     u64 *field, u8 *width, u32 n) {                          \
+  BitCursor_##v c = bit_cursor_##v(buf, size, start);                         \
+  bit_read_n_##v(&c, field, width, n);                                        \
+}                                                                             \
+void cursor_write_##v(u8 *buf, u64 size, u64 start,                           \
+                      u64 *field, u8 *width, u32 n) {                         \
+  BitCursor_##v c = bit_cursor_##v(buf, size, start);                         \
+  bit_write_n_##v(&c, field, width, n);                                       \
+  bit_flush_##v(&c);                                                          \
+}
+CURSOR_IO(le_lsb0)
+CURSOR_IO(le_msb0)
+CURSOR_IO(be_lsb0)
+CURSOR_IO(be_msb0)
+
+typedef void CursorFn(u8 *buf, u64 size, u64 start, u64 *field, u8 *width, u32 n);
+CursorFn *cursor_read[VARIANTS] = { cursor_read_le_lsb0, cursor_read_le_msb0, cursor_read_be_lsb0, cursor_read_be_msb0 };
+CursorFn *cursor_write[VARIANTS] = { cursor_write_le_lsb0, cursor_write_le_msb0, cursor_write_be_lsb0, cursor_write_be_msb0 };
+
+u64 failures = 0;
+void fail(enum Variant var, const char *what, u32 len, u64 start, u64 want, u64 got) {
+  if (failures++ < 16) {
+    printf("(%s) %s len %u start %llu: %llX ? %llX\n", variant_name[var], what, len,
+           (unsigned long long) start, (unsigned long long) want, (unsigned long long) got);
+  }
+}
+
+#define TEST_BYTES 80
+u64 test_variant(enum Variant var) {
+  u8 bg[TEST_BYTES], want[TEST_BYTES], got[TEST_BYTES];
+  u64 checks = 0;
+
+  for (u32 fill = 0; fill < 3; fill++) {
+    for (u32 b = 0; b < TEST_BYTES; b++) {
+      bg[b] = fill == 0? 0x00 : fill == 1? 0xFF : rand();
+    }
+
+    for (u32 len = 1; len <= 64; len++) {
+      for (u64 start = 0; start + len <= TEST_BYTES*8; start++) {
+        for (u32 kind = 0; kind < PATTERNS; kind++) {
+          u64 v = pattern(kind, len);
+          memcpy(want, bg, TEST_BYTES);
+          write_bits_ref(want, start, len, v, var);
+          if (read_bits_ref(want, start, len, var) != v) {
+            fail(var, "reference", len, start, v, read_bits_ref(want, start, len, var));
           }
-          if (n<i) {
-            buf[j] = Vf & ((1<<(i-n))-1);
+
+          u64 y = read_fast(var, want, TEST_BYTES, start, len);
+          if (y != v) fail(var, "read fast", len, start, v, y);
+
+          u8 width = len;
+          cursor_read[var](want, TEST_BYTES, start, &y, &width, 1);
+          if (y != v) fail(var, "read cursor", len, start, v, y);
+
+          if (len <= ORIG_MAX_LEN && (start >> 3) < ORIG_MAX_BYTE) {
+            y = read_orig(var, want, start, len);
+            if (y != v) fail(var, "read orig", len, start, v, y);
           }
 
-        }
+          memcpy(got, bg, TEST_BYTES);
+          write_fast(var, got, TEST_BYTES, start, len, v);
+          if (memcmp(got, want, TEST_BYTES)) fail(var, "write fast", len, start, v, read_bits_ref(got, start, len, var));
 
-        for (u32 b = 0; b < sizeof(B)/2; b++) {
-          u8 t = buf[b];
-          buf[b] = buf[sizeof(B)-1-b];
-          buf[sizeof(B)-1-b] = t;
-        }
-        memcpy(&B, buf, sizeof(B));
-        for (u32 b = 0; b < sizeof(B)/2; b++) {
-          u8 t = buf[b];
-          buf[b] = buf[sizeof(B)-1-b];
-          buf[sizeof(B)-1-b] = t;
-        }
-        memcpy(buf+12, buf, sizeof(B));
-        memset(buf, 0, sizeof(B));
+          memcpy(got, bg, TEST_BYTES);
+          cursor_write[var](got, TEST_BYTES, start, &v, &width, 1);
+          if (memcmp(got, want, TEST_BYTES)) fail(var, "write cursor", len, start, v, read_bits_ref(got, start, len, var));
 
-        u32 S = s + 12*8;
-        u32 y = read_bits_be_lsb0(buf, S, i);
-        if (y != V) {
-          y = read_bits_be_lsb0(buf, S, i);
-        }
-        if (y != V) {
-          printf("%X, %X ", i, s);
-          printf("(BE, LSB0) %08X : %X ? %X \n", B, V, y);
+          if (var == LE_LSB0 && len <= ORIG_MAX_LEN && (start >> 3) < ORIG_MAX_BYTE) {
+            memcpy(got, bg, TEST_BYTES);
+            write_bits_le_lsb0(got, start, len, v);
+            if (memcmp(got, want, TEST_BYTES)) fail(var, "write orig", len, start, v, read_bits_ref(got, start, len, var));
+          }
+          checks++;
         }
       }
     }
-    printf("\n");
-
-    for (u32 i = 1; i <= 16; i++) { // LE LSB0
-      for (u32 s = 0; s < 16; s++) {
-        memset(buf, 0xFF, sizeof(buf));
-
-        u32 V;
-        V = (1<<i)-1; // full bit pattern
-        V = 1<<(i-1); // msb only
-        V = 0xAAAA >> (16-i); // every other bit, msb=1
-        V = 0xCCCC >> (16-i); // every 2 bits, msb=1
-        // V = 0x3333 >> (16-i); // every 2 bits, msb=0
-        // V = 0x5555 >> (16-i); // every other bit, msb=0
-
-        u32 Vf = V | ((0xFFFF << i) & 0xFFFF);
-        u32 B = Vf << s;
-        u32 S = s + 12*8;
-
-        // memcpy(buf+12, &B, sizeof(B));
-        write_bits_le_lsb0(buf, S, i, Vf);
-
-        u32 y = read_bits_le_lsb0(buf, S, i);
-        if (y != V) {
-          y = read_bits_le_lsb0(buf, S, i);
-        }
-        if (y != V) {
-          printf("%X, %X ", i, s);
-          printf("(LE, LSB0) %08X : %X ? %X \n", B, V, y);
-        }
+
+    // sequential streams of mixed width fields
+    for (u32 t = 0; t < 1000; t++) {
+      u64 field[TEST_BYTES*8], back[TEST_BYTES*8];
+      u8 width[TEST_BYTES*8];
+      u64 start = rand() % 64;
+      u64 end = start;
+      u32 n = 0;
+      for (u32 w; end + (w = 1 + rand() % 64) <= TEST_BYTES*8; end += w) {
+        width[n] = t & 1? w : 1 + (w & 7); // small fields on alternate runs
+        field[n] = pattern(rand() % PATTERNS, width[n]);
+        w = width[n];
+        n++;
       }
-    }
-    printf("\n");
-
-    for (u32 i = 1; i <= 16; i++) { // LE MSB0
-      for (u32 s = 0; s < 16; s++) {
-        memset(buf, 0xFF, sizeof(buf));
-
-        u32 V;
-        V = (1<<i)-1; // full bit pattern
-        // V = 1<<(i-1); // msb only
-        // V = 0xAAAA >> (16-i); // every other bit, msb=1
-        // V = 0xCCCC >> (16-i); // every 2 bits, msb=1
-        // V = 0x3333 >> (16-i); // every 2 bits, msb=0
-        // V = 0x5555 >> (16-i); // every other bit, msb=0
-
-        u32 Vf = V | ((0xFFFF << i) & 0xFFFF);
-        u32 B;
-        {
-          u8 j = s>>3;
-          u8 ir = s&7;
-          u8 n = 0;
-
-          if (ir) {
-            n = 8-ir;
-            if (n < i) {
-              buf[j++] = (Vf & ((1<<n)-1));
-            } else {
-              buf[j++] = (Vf & ((1<<i)-1)) << (n-i);
-            }
-          }
 
-          while (n+8u < i) {
-            buf[j++] = (Vf >> n);
-            n += 8;
-          }
+      memcpy(want, bg, TEST_BYTES);
+      for (u32 k = 0, p = start; k < n; p += width[k++]) {
+        write_bits_ref(want, p, width[k], field[k], var);
+      }
 
-          if (n < i) {
-            buf[j] = (Vf >> n) << (8-(i-n));
-          }
-        }
-        
-        memcpy(&B, buf, sizeof(B));
-        memcpy(buf+12, buf, sizeof(B));
-        memset(buf, 0, sizeof(B));
-
-        u32 S = s + 12*8;
-        u32 y = read_bits_le_msb0(buf, S, i);
-        if (y != V) {
-          y = read_bits_le_msb0(buf, S, i);
-        }
-        if (y != V) {
-          printf("%X, %X ", i, s);
-          printf("(LE, MSB0) %08X : %X ? %X \n", B, V, y);
+      memcpy(got, bg, TEST_BYTES);
+      cursor_write[var](got, TEST_BYTES, start, field, width, n);
+      if (memcmp(got, want, TEST_BYTES)) fail(var, "stream write", n, start, 0, 0);
+
+      cursor_read[var](want, TEST_BYTES, start, back, width, n);
+      for (u32 k = 0; k < n; k++) {
+        if (back[k] != field[k]) {
+          fail(var, "stream read", width[k], k, field[k], back[k]);
+          break;
         }
       }
+      checks++;
+    }
+  }
+
+  return checks;
+}
+
+double now_ns(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec*1e9 + t.tv_nsec;
+}
+
+volatile u64 bench_sink;
+
+#define BENCH_FIELDS (1 << 20)
+#define BENCH_OFFSETS 4096
+#define BENCH_STREAM (4 << 20)
+
+/* Random access reads use a 256 byte buffer so the originals can take part;
+   sequential reads go through a 4MB buffer, which the originals can't index.
+   Results per variant: ns/field and GB/s of packed data consumed for
+   random-access orig, random-access fast, sequential fast and sequential
+   cursor. NaN where a method doesn't support the width.
+*/
+#define BENCH(v)                                                              \
+void bench_##v(FILE *f, u8 *small, u32 *offset, u8 *stream) {                 \
+  for (u32 len = 1; len <= 64; len++) {                                       \
+    double ns[4];                                                             \
+    u64 sum = 0;                                                              \
+                                                                              \
+    double t = now_ns();                                                      \
+    if (len <= ORIG_MAX_LEN) {                                                \
+      for (u32 k = 0; k < BENCH_FIELDS; k++)                                  \
+        sum += read_bits_##v(small, offset[k & (BENCH_OFFSETS-1)], len);      \
+      ns[0] = (now_ns() - t)/BENCH_FIELDS;                                    \
+    } else {                                                                  \
+      ns[0] = NAN;                                                            \
+    }                                                                         \
+                                                                              \
+    t = now_ns();                                                             \
+    for (u32 k = 0; k < BENCH_FIELDS; k++)                                    \
+      sum += read_bits_##v##_fast(small, 256,                                 \
+                                  offset[k & (BENCH_OFFSETS-1)], len);        \
+    ns[1] = (now_ns() - t)/BENCH_FIELDS;                                      \
+                                                                              \
+    u64 fields = (u64) BENCH_STREAM*8/len;                                    \
+    t = now_ns();                                                             \
+    for (u64 k = 0, p = 0; k < fields; k++, p += len)                         \
+      sum += read_bits_##v##_fast(stream, BENCH_STREAM, p, len);              \
+    ns[2] = (now_ns() - t)/fields;                                            \
+                                                                              \
+    t = now_ns();                                                             \
+    BitCursor_##v c = bit_cursor_##v(stream, BENCH_STREAM, 0);                \
+    for (u64 k = 0; k < fields; k++)                                          \
+      sum += bit_read_##v(&c, len);                                           \
+    ns[3] = (now_ns() - t)/fields;                                            \
+                                                                              \
+    bench_sink = sum;                                                         \
+    fprintf(f, "%2u", len);                                                   \
+    for (u32 m = 0; m < 4; m++) fprintf(f, " %8.3f", ns[m]);                  \
+    for (u32 m = 0; m < 4; m++) fprintf(f, " %8.3f", len/8.0/ns[m]);          \
+    fprintf(f, "\n");                                                         \
+  }                                                                           \
+}
+BENCH(le_lsb0)
+BENCH(le_msb0)
+BENCH(be_lsb0)
+BENCH(be_msb0)
+
+int main(int argc, char **argv) {
+  int bench = argc > 1 && strcmp(argv[1], "bench") == 0;
+
+  u64 checks = 0;
+  for (enum Variant var = 0; var < VARIANTS; var++) {
+    u64 before = failures;
+    u64 n = test_variant(var);
+    checks += n;
+    printf("(%s) %llu checks, %llu failures\n", variant_name[var],
+           (unsigned long long) n, (unsigned long long) (failures - before));
+  }
+  if (failures) {
+    return 1;
+  }
+
+  if (bench) {
+    u8 *small = malloc(256 + 8);
+    u32 *offset = malloc(BENCH_OFFSETS*sizeof(u32));
+    u8 *stream = malloc(BENCH_STREAM);
+    for (u32 i = 0; i < 256; i++) small[i] = rand();
+    for (u32 i = 0; i < BENCH_OFFSETS; i++) offset[i] = rand() % (ORIG_MAX_BYTE*8);
+    for (u32 i = 0; i < BENCH_STREAM; i++) stream[i] = rand();
+
+    FILE *f = fopen("bit-byte-bs-bench.dat", "w");
+    void (*bench_fn[VARIANTS])(FILE*, u8*, u32*, u8*) = { bench_le_lsb0, bench_le_msb0, bench_be_lsb0, bench_be_msb0 };
+    for (enum Variant var = 0; var < VARIANTS; var++) {
+      fprintf(f, "# %s\n# len  ns/field: orig fast seq cursor  GB/s: orig fast seq cursor\n", variant_name[var]);
+      bench_fn[var](f, small, offset, stream);
+      fprintf(f, "\n\n");
+      printf("(%s) benchmarked\n", variant_name[var]);
     }
-    printf("\n");
+    fclose(f);
+  }
 
-}
\ No newline at end of file
+  return 0;
+}
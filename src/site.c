@@ -32,75 +32,94 @@ struct Block {
   str id;
   str title;
   Text* text;
+  Text* last;
 };
 
-Block* push_block(Arena *a, Block *b, enum BlockType type, str *line);
-Block* parse_md(Arena *a, str input) {
-  Block *first = Arena_struct_zero(a, Block);
+#include <stdio.h> // fprintf
+
+typedef struct Parser Parser;
+struct Parser {
+  Arena *a;
+  str file;     // for warnings
+  s32 line;
+  s32 warnings;
+};
+
+void parse_warn(Parser *p, const char *msg) {
+  if (p->warnings++ < 16) {
+    fprintf(stderr, "%.*s:%d: warning: %s\n", (s32) p->file.len, p->file.str, p->line, msg);
+  }
+}
+
+Block* push_block(Parser *p, Block *b, enum BlockType type, str *line);
+Block* parse_md(Parser *p, str input) {
+  Block *first = Arena_struct_zero(p->a, Block);
   Block *b = first;
 
   s32 code_block = 0;
-  while (input.len > 0) {
+  for (; input.len > 0; p->line++) {
     str raw = str_cut_char(&input, '\n');
     str line = str_skip_whitespace(raw);
 
     if (str_startl(line, "```")) { // special case for code blocks
       if (b->type != CODE) {
-        b = push_block(a, b, CODE, 0);
+        b = push_block(p, b, CODE, 0);
         b->id = str_trim_whitespace(str_skip(line, 3));
         b->num = code_block++;
       } else {
-        b = push_block(a, b, 0, 0);
+        b = push_block(p, b, 0, 0);
       }
 
     } else if (b->type == CODE) {
-      b = push_block(a, b, CODE, &raw);
+      b = push_block(p, b, CODE, &raw);
 
     } else if (line.len == 0) {
-      b = push_block(a, b, 0, 0);
+      b = push_block(p, b, 0, 0);
 
     } else if (str_startl(line, "---")) {
-      b = push_block(a, b, RULE, 0);
+      b = push_block(p, b, RULE, 0);
 
     } else if (str_startl(line, "- ")) { 
       // TODO(lf) UN_LIST and ORD_LIST dont support nested lists
       line = str_skip(line, 2);
-      b = push_block(a, b, UN_LIST, &line);
+      b = push_block(p, b, UN_LIST, &line);
 
-    } else if (char_is_num(line.str[0]) && line.str[1] == '.' && line.str[2] == ' ') {
+    } else if (line.len >= 3 && char_is_num(line.str[0]) && line.str[1] == '.' && line.str[2] == ' ') {
       line = str_skip(line, 3);
-      b = push_block(a, b, ORD_LIST, &line);
+      b = push_block(p, b, ORD_LIST, &line);
 
     } else if (str_startl(line, "!|")) {
       line = str_skip(line, 2);
 
       if (b->type != TABLE) {
         s64 loc = str_find_char(line, '|');
+        loc = loc < 0? line.len : loc;
         str id = str_first(line, loc);
         line = str_skip(line, loc);
-        b = push_block(a, b, TABLE, &line);
+        b = push_block(p, b, TABLE, &line);
         b->id = id;
       } else {
-        b = push_block(a, b, TABLE, &line);
+        b = push_block(p, b, TABLE, &line);
       }
 
     } else if (str_startl(line, "> ")) {
       line = str_skip(line, 2);
-      b = push_block(a, b, QUOTE, &line);
+      b = push_block(p, b, QUOTE, &line);
 
     } else if (line.str[0] == '#') {
-      b = push_block(a, b, 0, 0);
-      while (line.str[b->num] == '#') {
+      b = push_block(p, b, 0, 0);
+      while (b->num < line.len && line.str[b->num] == '#') {
         b->num++;
       }
       line = str_skip(line, b->num);
       b->id = line;
       b->id.len = str_find_char(b->id, ' ');
+      b->id.len = b->id.len < 0? line.len : b->id.len;
       line = str_skip(line, b->id.len);
-      b = push_block(a, b, HEADING, &line);
+      b = push_block(p, b, HEADING, &line);
 
     } else {
-      b = push_block(a, b, PARAGRAPH, &line);
+      b = push_block(p, b, PARAGRAPH, &line);
     }
 
   }
@@ -117,29 +136,64 @@ bool match_prefix(str *s, char *pre, s32 *tok_len) {
       break;
     }
   }
+  match = match && !pre[i];
   *s = match? str_skip(*s, i) : *s;
   *tok_len = match? i : 0; 
-  return match && !pre[i];
+  return match;
 }
 
-// returns remaining string to be parsed
-str parse_inline(Arena *a, Text *p) {
-  str s = p->s;
-  s32 tok_len = 0;
-  enum TextStyle stop = p->type;
+/* NOTE(lf) Inline styles are parsed with an explicit stack instead of
+   recursion, so the depth is capped and every byte is looked at once:
+   - A style opener nests a new node, and the same marker closes it.
+     Only the innermost style can be closed.
+   - Past INLINE_MAX_DEPTH, openers are kept as text.
+   - Styles still open at the end of the line turn back into text, except
+     table cells which the end of the line closes.
+   - @( !( ?( without a ')' on the line are kept as text.
+   Each node's text is followed by its children, linked through next, so
+   rendering only recurses as deep as the nesting.
+*/
+#define INLINE_MAX_DEPTH 32
+
+typedef struct InlineFrame InlineFrame;
+struct InlineFrame {
+  Text *node;
+  Text *last;   // last child
+  s32 tok_len;
+};
 
-  if (stop == LINK || stop == IMAGE || stop == EXPLAIN) {
-    s64 loc = str_find_char(s, ')');
-    ASSERT(loc >= 0, "parenthesis must close!");
-    p->s = str_first(s, loc);
-    return str_skip(s, loc+1);
-  }
+void parse_inline(Parser *p, Text *root) {
+  str s = root->s;
+  u8 *end = s.str + s.len;
+
+  InlineFrame stack[INLINE_MAX_DEPTH];
+  s32 depth = 0;
+  stack[0] = (InlineFrame){ root, 0, 0 };
+
+  Text *text = root; // node that owns the current run of text
+  u8 *run = s.str;
+  u8 *paren = s.str;  // next ')' at or after paren, or end if none
+  bool no_paren = false;
+  bool too_deep = false;
+
+  #define INLINE_FLUSH(at) do {                              \
+    if (!text && (at) > run) {                               \
+      text = Arena_struct_zero(p->a, Text);                  \
+      InlineFrame *f = &stack[depth];                        \
+      if (f->last) f->last->next = text; else f->node->child = text; \
+      f->last = text;                                        \
+    }                                                        \
+    if (text) text->s = (str){ run, (at) - run };            \
+    text = 0;                                                \
+  } while (0)
 
+  s32 tok_len = 0;
   while (s.len > 0) {
     while (s.len > 0 && (char_is_whitespace(s.str[0]) || char_is_alphanum(s.str[0]))) {
       s = str_skip(s, 1);
     }
 
+    u8 *at = s.str;
     enum TextStyle tok = NONE;
     if (match_prefix(&s, "\\", &tok_len)) { tok = SKIP; } 
     else if (match_prefix(&s, "**", &tok_len)) { tok = BOLD; }
@@ -152,65 +206,125 @@ str parse_inline(Arena *a, Text *p) {
     else if (match_prefix(&s, "?(", &tok_len)) { tok = EXPLAIN; }
     else { s = str_skip(s, 1); }
 
-    if (tok != NONE) {
-      if (tok == stop) {
-        break;
-      } else if (p->type == SKIP) {
-        p->type = NONE;
-        tok_len = 0;
-        break;
-      } else {
-        // Finish current 
-        p->s = str_first(p->s, (s.str - p->s.str) - tok_len);
+    if (tok == NONE) {
+      continue;
+    }
+
+    if (tok == BOLD && stack[depth].node->type == ITALIC
+        && depth > 1 && stack[depth-1].node->type == BOLD) {
+      // ***a*** closes as *, then **, but *a **b** c* still nests bold
+      tok = ITALIC;
+      tok_len = 1;
+      s = (str){ s.str - 1, s.len + 1 };
+    }
 
-        p->child = Arena_struct_zero(a, Text); 
-        p->child->type = tok;
-        p->child->s = s;
-        s = parse_inline(a, p->child);
+    if (tok == SKIP) {
+      // the next marker, or byte, is text
+      INLINE_FLUSH(at);
+      run = s.str;
+      s32 skip_len = 0;
+      if (!(match_prefix(&s, "**", &skip_len) || match_prefix(&s, "~~", &skip_len)
+         || match_prefix(&s, "@(", &skip_len) || match_prefix(&s, "!(", &skip_len)
+         || match_prefix(&s, "?(", &skip_len))) {
+        s = str_skip(s, 1);
+      }
+
+    } else if (tok == LINK || tok == IMAGE || tok == EXPLAIN) {
+      if (!no_paren && paren < s.str) {
+        s64 loc = str_find_char(s, ')');
+        no_paren = loc < 0;
+        paren = no_paren? end : s.str + loc;
+        if (no_paren) {
+          parse_warn(p, "unclosed '(' kept as text");
+        }
+      }
+      if (no_paren) {
+        continue;
+      }
 
-        p->child->next = Arena_struct_zero(a, Text);
-        p = p->child->next;
-        p->type = NONE;
-        p->s = s;
+      INLINE_FLUSH(at);
+      Text *t = Arena_struct_zero(p->a, Text);
+      t->type = tok;
+      t->s = (str){ s.str, paren - s.str };
+      InlineFrame *f = &stack[depth];
+      if (f->last) f->last->next = t; else f->node->child = t;
+      f->last = t;
+      s = str_skip(s, t->s.len + 1);
+      run = s.str;
+
+    } else if (depth > 0 && tok == stack[depth].node->type) {
+      INLINE_FLUSH(at);
+      depth--;
+      run = s.str;
+
+    } else if (depth + 1 >= INLINE_MAX_DEPTH) {
+      if (!too_deep) {
+        parse_warn(p, "styles nested too deep, kept as text");
       }
+      too_deep = true;
+
+    } else {
+      INLINE_FLUSH(at);
+      Text *t = Arena_struct_zero(p->a, Text);
+      t->type = tok;
+      t->s = (str){ s.str, 0 };
+      InlineFrame *f = &stack[depth];
+      if (f->last) f->last->next = t; else f->node->child = t;
+      f->last = t;
+      stack[++depth] = (InlineFrame){ t, 0, tok_len };
+      text = t;
+      run = s.str;
     }
   }
 
-  p->s = str_first(p->s, MAX(0, (s.str - p->s.str) - tok_len));
-  ASSERT(p->s.len >= 0, "Invalid length %d!", (s32) p->s.len);
-
-  return s;
+  INLINE_FLUSH(end);
+  #undef INLINE_FLUSH
+
+  bool unclosed = false;
+  for (; depth > 0; depth--) {
+    Text *t = stack[depth].node;
+    if (t->type != TABLE_CELL) {
+      unclosed = true;
+      t->type = NONE;
+      t->s.str -= stack[depth].tok_len;
+      t->s.len += stack[depth].tok_len;
+    }
+  }
+  if (unclosed) {
+    parse_warn(p, "unclosed style kept as text");
+  }
 }
 
-Block* push_block(Arena *a, Block *b, enum BlockType type, str *line) {
+Block* push_block(Parser *p, Block *b, enum BlockType type, str *line) {
   if (b->type != type && b->type) {
-    b = (b->next = Arena_struct_zero(a, Block));
+    b = (b->next = Arena_struct_zero(p->a, Block));
   }
   b->type = type;
 
   if (line) {
-    Text *next = Arena_struct_zero(a, Text);
-
-    Text *last = b->text;
-    if (!last) {
+    Text *next = Arena_struct_zero(p->a, Text);
+    if (!b->last) {
       b->text = next;
     } else {
-      while (last->next) {
-        last = last->next;
-      }
-      last->next = next;
+      b->last->next = next;
     }
+    b->last = next;
 
     next->s = *line;
 
     if (b->type != CODE) {
-      parse_inline(a, next);
+      parse_inline(p, next);
     }
   }
 
   return b;
 }
 
+#include <string.h> // memcpy
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 // REF: https://nullprogram.com/blog/2023/02/13/
 typedef struct Buf Buf;
 struct Buf { 
@@ -223,8 +337,8 @@ struct Buf {
 void append(Buf *b, u8 *data, s32 len) {
   s32 avail = b->cap - b->len;
   s32 amount = b->err? 0 : CLAMP(len, 0, avail);
-  for (s32 i = 0; i < amount; i++) {
-    b->buf[b->len+i] = data[i];
+  if (amount > 0) {
+    memcpy(b->buf + b->len, data, amount);
   }
   b->len += amount;
   b->err |= amount < len;
@@ -232,7 +346,94 @@ void append(Buf *b, u8 *data, s32 len) {
 #define append_strl(b, sl) append(b, (u8*)sl, sizeof(sl"")-1)
 void append_str(Buf *b, str s) { append(b, s.str, s.len); }
 
-void append_html_inline(Buf *out, Text *t) {
+/* NOTE(lf) All text goes through append_escaped in one of these modes:
+   ESC_TEXT    text that is never markup, like code
+   ESC_ATTR    quoted attribute values, also used for rss.xml
+   ESC_MARKUP  markdown text, where raw tags and entities are allowed through
+               but stray '<' and '&' are escaped
+   Clean runs are found 16 bytes at a time and copied in bulk.
+*/
+enum Escape {
+  ESC_TEXT = 1,
+  ESC_ATTR = 2,
+  ESC_MARKUP = 4,
+};
+
+const u8 escape_class[256] = {
+  ['&'] = ESC_TEXT | ESC_ATTR | ESC_MARKUP,
+  ['<'] = ESC_TEXT | ESC_ATTR | ESC_MARKUP,
+  ['>'] = ESC_TEXT | ESC_ATTR,
+  ['"'] = ESC_ATTR,
+  ['\''] = ESC_ATTR,
+};
+
+const str escape_entity[256] = {
+  ['&'] = strl("&amp;"),
+  ['<'] = strl("&lt;"),
+  ['>'] = strl("&gt;"),
+  ['"'] = strl("&quot;"),
+  ['\''] = strl("&#39;"),
+};
+
+// returns the index of the next byte that needs escaping in mode, or len
+s64 escape_scan(u8 *s, s64 len, u8 mode) {
+  s64 i = 0;
+#if defined(__SSE2__)
+  __m128i amp = _mm_set1_epi8('&');
+  __m128i lt = _mm_set1_epi8('<');
+  __m128i gt = _mm_set1_epi8(mode & ESC_MARKUP? '<' : '>');
+  __m128i quot = _mm_set1_epi8(mode & ESC_ATTR? '"' : '<');
+  __m128i apos = _mm_set1_epi8(mode & ESC_ATTR? '\'' : '<');
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128((__m128i*) (s + i));
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, amp), _mm_cmpeq_epi8(v, lt));
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(v, gt));
+    m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, quot), _mm_cmpeq_epi8(v, apos)));
+    s32 bits = _mm_movemask_epi8(m);
+    if (bits) {
+      return i + __builtin_ctz(bits);
+    }
+  }
+#endif
+  for (; i < len && !(escape_class[s[i]] & mode); i++);
+  return i;
+}
+
+// in ESC_MARKUP, tags, comments and entities are passed through as written
+bool markup_passthrough(str s) {
+  if (s.len < 2) {
+    return false;
+  }
+  if (s.str[0] == '<') {
+    u8 c = s.str[1];
+    return char_is_alpha(c) || c == '/' || c == '!' || c == '?';
+  }
+
+  s64 i = 1;
+  for (; i < MIN(s.len, 32) && (char_is_alphanum(s.str[i]) || s.str[i] == '#'); i++);
+  return i > 1 && i < s.len && s.str[i] == ';';
+}
+
+void append_escaped(Buf *out, str s, u8 mode) {
+  while (s.len > 0) {
+    s64 i = escape_scan(s.str, s.len, mode);
+    append(out, s.str, i);
+    if (i == s.len) {
+      break;
+    }
+
+    s = str_skip(s, i);
+    if (mode == ESC_MARKUP && markup_passthrough(s)) {
+      append(out, s.str, 1);
+    } else {
+      append_str(out, escape_entity[s.str[0]]);
+    }
+    s = str_skip(s, 1);
+  }
+}
+
+void append_html_inline(Buf *out, Text *t);
+void append_html_text(Buf *out, Text *t) {
   const str tags[TEXT_STYLES] = {
   [BOLD] = strl("<b>"), 
   [ITALIC] = strl("<em>"), 
@@ -240,47 +441,51 @@ void append_html_inline(Buf *out, Text *t) {
   [CODE_INLINE] = strl("<code>"),
   [TABLE_CELL] = strl("<td>"),
   };
-  for (; t; t = t->next) {
-    str s = t->s;
-    if (t->type == LINK) {
-      append_strl(out, "<a href='");
-      append_str(out, str_cut_char(&s, ' '));
-      append_strl(out, "'>");
-      append_str(out, s);
-      append_strl(out, "</a>");
-    } else if (t->type == EXPLAIN) {
-      append_strl(out, "<abbr title=\"");
-      append_str(out, str_cut_char(&s, ','));
-      append_strl(out, "\">");
-      append_str(out, s);
-      append_strl(out, "</abbr>");
-    } else if (t->type == IMAGE) {
-      if (str_endl(s, ".mp4")) {
-        append_strl(out, "<video controls><source src='");
-        append_str(out, s);
-        append_strl(out, "' type='video/mp4'></video>");
-      } else {
-        append_strl(out, "<img src='");
-        append_str(out, s);
-        append_strl(out, "'>");
-      }
+  str s = t->s;
+  if (t->type == LINK) {
+    append_strl(out, "<a href='");
+    append_escaped(out, str_cut_char(&s, ' '), ESC_ATTR);
+    append_strl(out, "'>");
+    append_escaped(out, s, ESC_MARKUP);
+    append_strl(out, "</a>");
+  } else if (t->type == EXPLAIN) {
+    append_strl(out, "<abbr title=\"");
+    append_escaped(out, str_cut_char(&s, ','), ESC_ATTR);
+    append_strl(out, "\">");
+    append_escaped(out, s, ESC_MARKUP);
+    append_strl(out, "</abbr>");
+  } else if (t->type == IMAGE) {
+    if (str_endl(s, ".mp4")) {
+      append_strl(out, "<video controls><source src='");
+      append_escaped(out, s, ESC_ATTR);
+      append_strl(out, "' type='video/mp4'></video>");
     } else {
-      str tag = tags[t->type]; 
-      if (tag.len > 0) {
-        append_str(out, tag);
-      }
+      append_strl(out, "<img src='");
+      append_escaped(out, s, ESC_ATTR);
+      append_strl(out, "'>");
+    }
+  } else {
+    str tag = tags[t->type]; 
+    if (tag.len > 0) {
+      append_str(out, tag);
+    }
 
-      append_str(out, s);
-      append_html_inline(out, t->child);
+    append_escaped(out, s, t->type == CODE_INLINE? ESC_TEXT : ESC_MARKUP);
+    append_html_inline(out, t->child);
 
-      if (tag.len > 0) {
-        append_strl(out, "</");
-        append_str(out, str_skip(tag, 1));
-      }
+    if (tag.len > 0) {
+      append_strl(out, "</");
+      append_str(out, str_skip(tag, 1));
     }
   }
 }
 
+void append_html_inline(Buf *out, Text *t) {
+  for (; t; t = t->next) {
+    append_html_text(out, t);
+  }
+}
+
 typedef struct Wrap Wrap;
 struct Wrap {
   enum BlockType type;
@@ -296,19 +501,22 @@ void append_wrap(Buf *out, Block *b, Wrap w) {
   if (b->type == w.type) {
     append_str(out, w.open);
 
-    for (Text *t = b->text; t; ) {
-      Text *tn = t->next; 
-      t->next = 0;
+    for (Text *t = b->text; t; t = t->next) {
       append_str(out, w.open_line);
-      append_html_inline(out, t);
+      append_html_text(out, t);
       append_str(out, w.close_line);
-      t = tn;
     }
 
     append_str(out, w.close);
   }
 }
 
+// bytes that can start a comment, string or escape in code blocks
+const bool code_stop[256] = {
+  ['/'] = 1, ['*'] = 1, ['#'] = 1, ['\''] = 1, ['"'] = 1,
+  ['<'] = 1, ['>'] = 1, ['&'] = 1,
+};
+
 str append_html(Buf *out, Block *b) {
   append_wrap(out, b, WRAP(PARAGRAPH, "<p>\n", "</p>\n", "", ""));
   append_wrap(out, b, WRAP(QUOTE, "<blockquote><p>\n", "</p></blockquote>\n", "", ""));
@@ -318,7 +526,7 @@ str append_html(Buf *out, Block *b) {
 
   if (b->type == TABLE) {
     append_strl(out, "<table class='");
-    append_str(out, b->id);
+    append_escaped(out, b->id, ESC_ATTR);
     append_strl(out, "'>\n");
     append_wrap(out, b, WRAP(TABLE, "", "</table>\n", "<tr>", "</tr>\n"));
   }
@@ -328,7 +536,7 @@ str append_html(Buf *out, Block *b) {
     append_strl(out, "<h");
     append(out, &n, 1);
     append_strl(out, " id='");
-    append_str(out, b->id);
+    append_escaped(out, b->id, ESC_ATTR);
     append_strl(out, "'>");
 
     append_html_inline(out, b->text);
@@ -339,24 +547,26 @@ str append_html(Buf *out, Block *b) {
   }
 
   if (b->type == CODE) {
-    char id[8];
-    if (b->id.len == 0) {
-      b->id.len = snprintf(id, sizeof(id), "code%03d", b->num);
-      b->id.str = (u8*) id;
+    char code_id[16];
+    str block_id = b->id;
+    if (block_id.len == 0) {
+      block_id.len = snprintf(code_id, sizeof(code_id), "code%03d", b->num);
+      block_id.str = (u8*) code_id;
     }
     append_strl(out, "<code id='");
-    append_str(out, b->id);
+    append_escaped(out, block_id, ESC_ATTR);
     append_strl(out, "'><pre>\n");
     s32 line = 1;
     s32 in_comment = 0;
     #define COMMENT_SPAN "<span class='code-comment'>"
     for (Text *t = b->text; t; t = t->next, line++) {
       char id[32]; 
-      s32 id_len = snprintf(id, sizeof(id), "%.*s-%d", (s32)b->id.len, b->id.str, line);
+      s32 id_len = snprintf(id, sizeof(id), "%.*s-%d", (s32)block_id.len, block_id.str, line);
+      id_len = MIN(id_len, (s32) sizeof(id) - 1);
       append_strl(out, "<span id='"); 
-      append(out, (u8*) id, id_len);
+      append_escaped(out, (str){ (u8*) id, id_len }, ESC_ATTR);
       append_strl(out, "'><a href='#"); 
-      append(out, (u8*) id, id_len);
+      append_escaped(out, (str){ (u8*) id, id_len }, ESC_ATTR);
       append_strl(out, "' aria-hidden='true'></a>"); 
 
       if (in_comment == 2) {
@@ -367,9 +577,9 @@ str append_html(Buf *out, Block *b) {
       str s = t->s;
       s32 i = 0;
 
-      bool no_comment = str_startl(b->id, "nc");
+      bool no_comment = str_startl(block_id, "nc");
       while (s.len > 0) {
-        while (i < s.len && (char_is_whitespace(s.str[i]) || char_is_alphanum(s.str[i]))) {
+        while (i < s.len && !code_stop[s.str[i]]) {
           i++;
         }
         append(out, s.str, i);
@@ -388,14 +598,8 @@ str append_html(Buf *out, Block *b) {
           append_strl(out, "*/</span>");
           in_comment = 0;
           s = str_skip(s, 2);
-        } else if (s.str[0] == '<') {
-          append_strl(out, "&lt;");
-          s = str_skip(s, 1);
-        } else if (s.str[0] == '>') {
-          append_strl(out, "&gt;");
-          s = str_skip(s, 1);
-        } else if (s.str[0] == '&') {
-          append_strl(out, "&amp;");
+        } else if (escape_class[s.str[0]] & ESC_TEXT) {
+          append_str(out, escape_entity[s.str[0]]);
           s = str_skip(s, 1);
         } else if (s.str[0] == '\'' || s.str[0] == '"') {
           i = 1;
@@ -429,16 +633,154 @@ str append_html(Buf *out, Block *b) {
   return (str){ out->buf, out->len };
 }
 
+/* NOTE(lf) Rendering API, separate from page discovery and file I/O.
+   Everything is allocated from the arena passed in and there is no global
+   state, so separate threads can render concurrently with separate arenas.
+   Parsing allocates a bounded number of nodes per input byte and the output
+   is capped at max_len, so a request arena can be sized up front with
+   render_arena_size.
+*/
+typedef struct Frontmatter Frontmatter;
+struct Frontmatter {
+  str title;
+  str date;
+  str desc;
+};
+
+typedef struct RenderOptions RenderOptions;
+struct RenderOptions {
+  str name;      // <title> for pages without frontmatter
+  str path;      // source file, for warnings
+  str header;    // optional, wrapped around the page
+  str footer;
+  bool article;  // frontmatter, title block and table of contents
+  s32 max_len;   // output cap, MB(2) if 0
+};
+
+typedef struct Page Page;
+struct Page {
+  Frontmatter meta;
+  Block *first;
+};
+
+Frontmatter parse_frontmatter(str *md) {
+  Frontmatter f;
+  str frontmatter = str_cut_sub(md, strl("---"));
+  f.title = str_skip_startl(str_cut_char(&frontmatter, '\n'), "title: ");
+  f.date = str_skip_startl(str_cut_char(&frontmatter, '\n'), "date: ");
+  f.desc = str_skip_startl(str_cut_char(&frontmatter, '\n'), "desc: ");
+  return f;
+}
+
+Page parse_page(Arena *a, str md, RenderOptions *opt) {
+  Page p = {};
+  Parser parser = { .a = a, .file = opt->path, .line = 1 };
+  if (opt->article) {
+    str body = md;
+    p.meta = parse_frontmatter(&md);
+    for (s64 i = 0; i < md.str - body.str; i++) {
+      parser.line += body.str[i] == '\n';
+    }
+  }
+  p.first = parse_md(&parser, md);
+  return p;
+}
+
+void append_toc(Buf *out, Block *first) {
+  s32 toc_level = 0; s32 toc_first = 0;
+  append_strl(out, "<ul class='sections'>\n");
+  for (Block *b = first; b; b = b->next) {
+    if (b->type == HEADING) {
+      if (toc_first == 0) {
+        toc_level = toc_first = b->num;
+      }
+
+      for (; toc_level < b->num; toc_level++)
+        append_strl(out, "<ul class='sections'>\n");
+      for (; toc_level > b->num; toc_level--)
+        append_strl(out, "</ul>\n");
+
+      append_strl(out, "<li><a href='#");
+      append_escaped(out, b->id, ESC_ATTR);
+      append_strl(out, "'>");
+      append_html_inline(out, b->text);
+      append_strl(out, "</a></li>\n");
+    }
+  }
+  for (; toc_level >= toc_first; toc_level--)
+    append_strl(out, "</ul>\n");
+  append_strl(out, "<hr>\n");
+}
+
+// returns a zero str if the output did not fit in max_len
+str render_parsed(Arena *a, Page *p, RenderOptions *opt) {
+  Buf out = {};
+  out.cap = opt->max_len > 0? opt->max_len : (s32) MB(2);
+  out.buf = Arena_bytes(a, out.cap);
+
+  append_str(&out, opt->header);
+  if (opt->article) {
+    append_strl(&out, "<title> 0A ");
+    append_escaped(&out, p->meta.title, ESC_MARKUP);
+    append_strl(&out, "</title>\n<div style='clear: both'>\n<h1>");
+    append_escaped(&out, p->meta.title, ESC_MARKUP);
+    append_strl(&out, "</h1>\n<h3>");
+    append_escaped(&out, str_first(p->meta.date, 16), ESC_MARKUP);
+    append_strl(&out, "</h3>\n</div>\n");
+    append_toc(&out, p->first);
+  } else {
+    append_strl(&out, "<title> 0A ");
+    append_escaped(&out, opt->name, ESC_MARKUP);
+    append_strl(&out, "</title>\n");
+  }
+
+  for (Block *b = p->first; b; b = b->next) {
+    append_html(&out, b);
+  }
+
+  if (opt->article) {
+    append_strl(&out, "<hr><p class='centert'>Feel free to email me any comments about this article: <code>contact@loganforman.com</code></p>" );
+  }
+  append_str(&out, opt->footer);
+
+  return out.err? (str){} : (str){ out.buf, out.len };
+}
+
+str render_page(Arena *a, str md, RenderOptions *opt) {
+  Page p = parse_page(a, md, opt);
+  return render_parsed(a, &p, opt);
+}
+
+// At most a Text per input byte and a Block per two, with room for padding.
+#define RENDER_BYTES_PER_INPUT 64
+
+// arena bytes render_page can take for md_len bytes of markdown
+s64 render_arena_size(s64 md_len, RenderOptions *opt) {
+  s64 out = opt->max_len > 0? opt->max_len : (s32) MB(2);
+  return md_len*RENDER_BYTES_PER_INPUT + out + 4096;
+}
+
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <signal.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <time.h>
 #include <dirent.h>
 
-str read_file(Arena *a, const char *path) {
-  str out; 
+str read_file(Arena *a, int dir, const char *path) {
+  str out = {}; 
   struct stat st;
-  int fd = open(path, O_RDONLY);
+  int fd = openat(dir, path, O_RDONLY);
   if (fstat(fd, &st) == 0) {
     out = str_sized(a, st.st_size);
     out.len = read(fd, out.str, st.st_size);
@@ -447,187 +789,1943 @@ str read_file(Arena *a, const char *path) {
   return out;
 }
 
-bool write_file(const char *path, u8* data, s64 len) {
-  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+// Reads only the start of the file, up to and including the "---" that ends
+// the frontmatter, or the whole file if there is none.
+str read_frontmatter(Arena *a, int dir, const char *path) {
+  str out = {};
+  struct stat st;
+  int fd = openat(dir, path, O_RDONLY);
+  if (fstat(fd, &st) == 0) {
+    s64 cap = MIN(512, st.st_size);
+    out = (str){ str_sized(a, cap).str, 0 };
+    while (true) {
+      ssize_t n = pread(fd, out.str + out.len, cap - out.len, out.len);
+      if (n <= 0) {
+        break;
+      }
+      out.len += n;
+
+      str rest = out;
+      str head = str_cut_sub(&rest, strl("---"));
+      if (head.len < out.len) {
+        out.len = head.len + 3;
+        break;
+      }
+      if (out.len < cap) {
+        continue;
+      }
+      if (cap == st.st_size) {
+        break;
+      }
+
+      // the arena is linear, so a bigger copy is cheaper than tracking pieces
+      cap = MIN(2*cap, st.st_size);
+      u8 *grown = str_sized(a, cap).str;
+      memcpy(grown, out.str, out.len);
+      out.str = grown;
+    }
+  }
+  close(fd);
+  return out;
+}
+
+bool write_filev(int dir, const char *path, str *part, s32 parts) {
+  int fd = openat(dir, path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+
+  struct iovec iov[4];
+  s64 len = 0;
+  for (s32 i = 0; i < parts; i++) {
+    iov[i] = (struct iovec){ part[i].str, part[i].len };
+    len += part[i].len;
+  }
 
   s64 n = 0;
-  while (n < len) {
-    s64 i = write(fd, data + n, len - n);
-    if (i > 0) {
-      n += i;
-    } else {
+  for (s32 i = 0; i < parts; ) {
+    s64 w = writev(fd, iov + i, parts - i);
+    if (w <= 0) {
       break;
     }
+    n += w;
+    for (; i < parts && w >= (s64) iov[i].iov_len; i++) {
+      w -= iov[i].iov_len;
+    }
+    if (i < parts) {
+      iov[i].iov_base = (u8*) iov[i].iov_base + w;
+      iov[i].iov_len -= w;
+    }
   }
   close(fd);
   return n != len;
 }
 
-int main(int argc, char *argv[]) {
-  UNUSED(argc);
-  UNUSED(argv);
-  Arena a = Arena_alloc((Arena){ .size = MB(32) });
+/* NOTE(lf) Every page is header + body + footer. In pack mode the bodies are
+   streamed into one archive instead, with the header and footer stored once
+   and an index of (path, offset, length) at the end. `site serve` splices
+   the three ranges back together with sendfile, so nothing is copied.
+*/
+#define PACK_MAGIC 0x4B504130 // "0APK"
+#define PACK_NAME "site.pack"
+
+typedef struct PackHeader PackHeader;
+struct PackHeader {
+  u32 magic;
+  u32 count;
+  u64 index;
+  u64 header_off;
+  u64 header_len;
+  u64 footer_off;
+  u64 footer_len;
+};
 
-  str header = read_file(&a, "src/header.html");
-  str footer = read_file(&a, "src/footer.html");
-  str rss_header = read_file(&a, "src/rss-header.xml");
+typedef struct PackEntry PackEntry;
+struct PackEntry {
+  char path[104];
+  u32 wrap;
+  u32 pad;
+  u64 off;
+  u64 len;
+};
 
-  Buf out = {};
-  out.cap = MB(2);
-  out.buf = Arena_bytes(&a, out.cap);
-
-  Buf rss = {};
-  rss.cap = MB(2);
-  rss.buf = Arena_bytes(&a, rss.cap);
-  append_str(&rss, rss_header);
-
-  Buf blog = {};
-  blog.cap = MB(2);
-  blog.buf = Arena_bytes(&a, blog.cap);
-  append_str(&blog, header);
-  append_strl(&blog, "<p><div class='center'> <img src='/assets/dd.png' /></div></p>\n");
-  append_strl(&blog, "<h2 id='center'>Logan Forman <a href='https://www.twitter.com/dev_dwarf'>@dev dwarf</a></h2>");
-  append_strl(&blog, "<table><th>Date<th>Title<th style='width: 50%'>Description\n");
-
-  ASSERT(chdir("pages/writing") == 0, "ERR: failed to chdir!");
-  ARENA_TEMP(a) {
-    DIR *dir = opendir(".");
-    str *article = Arena_array(&a, str, 4096);
-    s32 articles = 0;
-    for (struct dirent* f; (f = readdir(dir)); ) {
-      if (f->d_type != DT_REG) continue;
-      str name = strc(f->d_name);
-      if (!str_endl(name, ".md")) continue;
+// Parsed pages are kept between rebuilds, keyed by path and mtime. Articles
+// loaded for the index alone keep only their frontmatter until rendered.
+typedef struct Cached Cached;
+struct Cached {
+  str path;     // relative to pages/
+  str out;      // relative to docs/
+  s64 mtime;
+  s64 size;
+  bool dirty;   // parsed but not yet written
+  bool parsed;  // page.first is valid, not just page.meta
+  RenderOptions opt;
+  Page page;
+
+  // articles only, rebuilt when the frontmatter changes
+  u64 meta_hash;
+  str blog_row;
+  str rss_item;
+};
 
-      s32 i = 0;
-      for (; i < articles; i++) {
-        if (memcmp(article[i].str, f->d_name, 3) <= 0) {
-          break;
+#define INDEX_FILES 512
+typedef struct IndexFile IndexFile;
+struct IndexFile {
+  u64 name;
+  u64 hash;
+};
+
+typedef struct Site Site;
+struct Site {
+  str header;
+  str footer;
+  str rss_header;
+  str style;      // docs/style.css, for --minify
+  s64 templates_mtime;
+  bool templates_dirty;
+  Arena templates;
+
+  Arena cache;
+  Cached *cached;
+  s32 *slot;
+  s32 cached_len;
+  s32 cached_cap;
+
+  IndexFile index_file[INDEX_FILES]; // what each index file was built from
+  s32 index_files;
+  s32 blog_page;  // articles per blog.html page, 0 for one page
+  s32 rss_items;  // newest articles kept in rss.xml, 0 for all
+  bool minify;    // collapse whitespace, inline the css each page uses if small
+
+  int pages;
+  int writing;
+  int docs;
+  int ast_dir;    // --cache, -1 if not caching parsed pages
+  int golden;     // `site check`, compared against instead of written, or -1
+  s32 mismatches;
+  int pack;
+  u64 pack_len;
+  PackEntry *entry;
+  s32 entries;
+  s32 entries_cap;
+
+  Buf *log;     // written paths, one per line
+};
+
+void pack_open(Site *site, Arena *a) {
+  site->pack = openat(site->docs, PACK_NAME, O_RDWR | O_CREAT | O_TRUNC, 0666);
+  ASSERT(site->pack >= 0, "ERR: failed to open %s!", PACK_NAME);
+  site->entries_cap = 8192;
+  site->entry = Arena_array(a, PackEntry, site->entries_cap);
+  site->entries = 0;
+
+  site->pack_len = sizeof(PackHeader);
+  pwrite(site->pack, site->header.str, site->header.len, site->pack_len);
+  site->pack_len += site->header.len;
+  pwrite(site->pack, site->footer.str, site->footer.len, site->pack_len);
+  site->pack_len += site->footer.len;
+}
+
+int pack_entry_cmp(const void *a, const void *b) {
+  return strcmp(((PackEntry*) a)->path, ((PackEntry*) b)->path);
+}
+
+bool pack_close(Site *site) {
+  if (site->pack < 0) {
+    return false;
+  }
+  qsort(site->entry, site->entries, sizeof(PackEntry), pack_entry_cmp);
+
+  PackHeader h = {
+    .magic = PACK_MAGIC,
+    .count = site->entries,
+    .index = site->pack_len,
+    .header_off = sizeof(PackHeader),
+    .header_len = site->header.len,
+    .footer_off = sizeof(PackHeader) + site->header.len,
+    .footer_len = site->footer.len,
+  };
+  s64 index_len = site->entries*sizeof(PackEntry);
+  bool err = pwrite(site->pack, site->entry, index_len, h.index) != index_len;
+  err |= pwrite(site->pack, &h, sizeof(h), 0) != sizeof(h);
+  close(site->pack);
+  site->pack = -1;
+  return err;
+}
+
+/* NOTE(lf) Optional output stage for wrapped pages (--minify):
+   - Whitespace runs collapse to a single space or newline, except inside
+     <pre> <code> <script> <style> <textarea> and quoted attributes.
+     Comments are dropped.
+   - Rules from docs/style.css are inlined in a <style> if their selectors
+     only name tags and classes the page contains. The stylesheet link is
+     swapped for a preload, so the rest arrives without blocking paint.
+     The inlined rules are bytes every page repeats, so this is only done
+     when they come to CRITICAL_CSS_MAX or less. Otherwise the link is
+     kept and the page is only ever smaller.
+*/
+#define CRITICAL_CSS_MAX 1024
+#define PAGE_TAGS 64
+#define PAGE_CLASSES 128
+typedef struct PageNames PageNames;
+struct PageNames {
+  str tag[PAGE_TAGS];
+  str class[PAGE_CLASSES];
+  s32 tags;
+  s32 classes;
+  bool full;    // too many to track, every selector counts as used
+};
+
+bool names_has(str *name, s32 names, str s) {
+  for (s32 i = 0; i < names; i++) {
+    if (str_eq(name[i], s)) return true;
+  }
+  return false;
+}
+
+void names_add(PageNames *n, str *name, s32 *names, s32 cap, str s) {
+  if (s.len == 0 || names_has(name, *names, s)) {
+    return;
+  }
+  if (*names == cap) {
+    n->full = true;
+    return;
+  }
+  name[(*names)++] = s;
+}
+
+bool char_is_name(u8 c) {
+  return char_is_alphanum(c) || c == '-' || c == '_';
+}
+
+s64 name_len(str s, s64 i) {
+  s64 j = i;
+  while (j < s.len && char_is_name(s.str[j])) j++;
+  return j - i;
+}
+
+// Tags and class='...' names in html, for matching against selectors.
+void collect_names(PageNames *n, str html) {
+  for (s64 i = 0; i < html.len; i++) {
+    if (html.str[i] != '<' || i + 1 == html.len || !char_is_alpha(html.str[i+1])) {
+      continue;
+    }
+    s64 len = name_len(html, i + 1);
+    names_add(n, n->tag, &n->tags, PAGE_TAGS, (str){ html.str + i + 1, len });
+
+    for (i += len + 1; i < html.len && html.str[i] != '>'; i++) {
+      u8 q = html.str[i];
+      if (q != '\'' && q != '"') {
+        continue;
+      }
+      bool is_class = i >= 6 && memcmp(html.str + i - 6, "class=", 6) == 0;
+      s64 end = i + 1;
+      while (end < html.len && html.str[end] != q) end++;
+      if (is_class) {
+        for (s64 j = i + 1; j < end; ) {
+          s64 len = name_len(html, j);
+          names_add(n, n->class, &n->classes, PAGE_CLASSES, (str){ html.str + j, len });
+          j += MAX(len, 1);
         }
       }
-      for (s32 j = articles; j > i; j--) {
-        article[j] = article[j-1];
+      i = end;
+    }
+  }
+}
+
+// A selector is used if every tag and class it names is on the page.
+// Ids, attributes and pseudo-classes don't rule a selector out.
+bool selector_used(PageNames *n, str sel) {
+  if (n->full) {
+    return true;
+  }
+  for (s64 i = 0; i < sel.len; ) {
+    u8 c = sel.str[i];
+    if (c == '.' || c == '#' || c == ':') {
+      while (i < sel.len && sel.str[i] == c) i++;
+      s64 len = name_len(sel, i);
+      if (c == '.' && !names_has(n->class, n->classes, (str){ sel.str + i, len })) {
+        return false;
+      }
+      i += len;
+      if (c == ':' && i < sel.len && sel.str[i] == '(') {
+        while (i < sel.len && sel.str[i] != ')') i++;
       }
-      article[i] = str_copy(&a, name);
-      articles++;
+    } else if (c == '[') {
+      while (i < sel.len && sel.str[i] != ']') i++;
+    } else if (char_is_alpha(c)) {
+      s64 len = name_len(sel, i);
+      if (!names_has(n->tag, n->tags, (str){ sel.str + i, len })) {
+        return false;
+      }
+      i += len;
+    } else {
+      i++;
+    }
+  }
+  return true;
+}
+
+// Appends s with whitespace runs collapsed to one space, dropping those
+// next to ':' ';' ',' where css doesn't need them.
+void append_collapsed(Buf *out, str s) {
+  s = str_skip_whitespace(str_trim_whitespace(s));
+  for (s64 i = 0; i < s.len; ) {
+    s64 j = i;
+    while (j < s.len && !char_is_whitespace(s.str[j])) j++;
+    append(out, s.str + i, j - i);
+    u8 before = s.str[j-1];
+    while (j < s.len && char_is_whitespace(s.str[j])) j++;
+    if (j < s.len && before != ':' && before != ';' && before != ',' && s.str[j] != ';') {
+      append_strl(out, " ");
+    }
+    i = j;
+  }
+}
+
+// Cuts a rule body off the front of css, up to the '}' matching the '{'
+// already cut, so blocks nested in @supports or @keyframes stay inside it.
+str cut_css_block(str *css) {
+  s64 i = 0;
+  for (s32 depth = 0; i < css->len && (depth > 0 || css->str[i] != '}'); i++) {
+    if (css->str[i] == '/' && i + 1 < css->len && css->str[i+1] == '*') {
+      str rest = str_skip(*css, i + 2);
+      str_cut_sub(&rest, strl("*/"));
+      i = rest.str - css->str - 1;
+    } else {
+      depth += (css->str[i] == '{') - (css->str[i] == '}');
+    }
+  }
+  str body = str_first(*css, i);
+  *css = str_skip(*css, i + 1);
+  return body;
+}
+
+// Appends the used rules of css up to the first unmatched '}', returning
+// what follows it. @media blocks are kept if any rule inside them is,
+// other at-rules are always kept.
+str append_used_css(Buf *out, PageNames *n, str css) {
+  while (css.len > 0) {
+    css = str_skip_whitespace(css);
+    if (str_startl(css, "/*")) {
+      str_cut_sub(&css, strl("*/"));
+      continue;
+    }
+    if (css.len == 0 || css.str[0] == '}') {
+      return str_skip(css, 1);
     }
-    closedir(dir);
-    
-    for (s32 i = 0; i < articles; i++) ARENA_TEMP(a) {
-      out.len = 0;
-      append_str(&out, header);
-
-      str md = read_file(&a, str_cstring(&a, article[i]));
-      str name = str_trim(str_skip(article[i], 4), 3);
-
-      str frontmatter = str_cut_sub(&md, strl("---"));
-      str title = str_skip_startl(str_cut_char(&frontmatter, '\n'), "title: ");
-      str date = str_skip_startl(str_cut_char(&frontmatter, '\n'), "date: ");
-      str desc = str_skip_startl(str_cut_char(&frontmatter, '\n'), "desc: ");
-      append_strl(&rss, "<item>\n<title>");
-      append_str(&rss, title);
-      append_strl(&rss, "</title>\n<description>");
-      append_str(&rss, desc);
-      append_strl(&rss, "</description>\n<link>https://loganforman.com/writing/");
-      append_str(&rss, name);
-      append_strl(&rss, ".html</link>\n<guid>https://loganforman.com/writing/");
-      append_str(&rss, name);
-      append_strl(&rss, ".html</guid>\n<pubDate>");
-      append_str(&rss, date);
-      append_strl(&rss, "</pubDate>\n</item>\n");
-
-      append_strl(&blog, "<tr><td><code>");
-      append_str(&blog, str_first(str_skip(date, 6), 11));
-      append_strl(&blog, "</code></td>\n<td><a href='/writing/");
-      append_str(&blog, name);
-      append_strl(&blog, ".html'>");
-      append_str(&blog, title);
-      append_strl(&blog, "</a></td>\n<td>");
-      append_str(&blog, desc);
-      append_strl(&blog, "</td>\n</tr>\n");
-
-      append_strl(&out, "<title> 0A ");
-      append_str(&out, title);
-      append_strl(&out, "</title>\n<div style='clear: both'>\n<h1>");
-      append_str(&out, title);
-      append_strl(&out, "</h1>\n<h3>");
-      append_str(&out, str_first(date, 16));
-      append_strl(&out, "</h3>\n</div>\n");
-
-      Block *first = parse_md(&a, md);
-
-      s32 toc_level = 0; s32 toc_first = 0;
-      append_strl(&out, "<ul class='sections'>\n");
-      for (Block *b = first; b; b = b->next) {
-        if (b->type == HEADING) {
-          if (toc_first == 0) {
-            toc_level = toc_first = b->num;
-          }
 
-          for (; toc_level < b->num; toc_level++)
-            append_strl(&out, "<ul class='sections'>\n");
-          for (; toc_level > b->num; toc_level--)
-            append_strl(&out, "</ul>\n");
+    str prelude = str_trim_whitespace(str_cut_char(&css, '{'));
+    if (str_startl(prelude, "@media")) {
+      s32 start = out->len;
+      append_collapsed(out, prelude);
+      append_strl(out, "{");
+      s32 inner = out->len;
+      css = append_used_css(out, n, css);
+      if (out->len == inner) {
+        out->len = start;
+      } else {
+        append_strl(out, "}");
+      }
+      continue;
+    }
+
+    str body = cut_css_block(&css);
+    bool first = true;
+    if (prelude.len > 0 && prelude.str[0] == '@') {
+      append_collapsed(out, prelude);
+      first = false;
+    } else {
+      while (prelude.len > 0) {
+        str sel = str_trim_whitespace(str_cut_char(&prelude, ','));
+        if (selector_used(n, sel)) {
+          if (!first) append_strl(out, ",");
+          append_collapsed(out, sel);
+          first = false;
+        }
+      }
+    }
+    if (!first) {
+      append_strl(out, "{");
+      append_collapsed(out, body);
+      append_strl(out, "}");
+    }
+  }
+  return css;
+}
+
+bool tag_has(str tag, str sub) {
+  for (s64 i = 0; i + sub.len <= tag.len; i++) {
+    if (memcmp(tag.str + i, sub.str, sub.len) == 0) return true;
+  }
+  return false;
+}
+
+// Appends a run of whitespace at i as one character, returning its end.
+s64 append_space(Buf *out, str html, s64 i) {
+  bool line = false;
+  for (; i < html.len && char_is_whitespace(html.str[i]); i++) {
+    line |= html.str[i] == '\n';
+  }
+  append(out, (u8*) (line? "\n" : " "), 1);
+  return i;
+}
+
+bool tag_is(str s, s64 i, str name) {
+  return i + name.len < s.len && memcmp(s.str + i, name.str, name.len) == 0
+    && !char_is_name(s.str[i + name.len]);
+}
+
+void append_minified(Buf *out, str html, str critical) {
+  str raw[] = { strl("pre"), strl("code"), strl("script"), strl("style"), strl("textarea") };
+  s32 raws = sizeof(raw)/sizeof(raw[0]);
+  s64 i = 0;
+  s64 run = 0;
+  while (i < html.len) {
+    u8 c = html.str[i];
+
+    if (char_is_whitespace(c)) {
+      append(out, html.str + run, i - run);
+      i = run = append_space(out, html, i);
+
+    } else if (c == '<' && str_startl(str_skip(html, i), "<!--")) {
+      append(out, html.str + run, i - run);
+      str rest = str_skip(html, i + 4);
+      str_cut_sub(&rest, strl("-->"));
+      i = run = rest.str - html.str;
+
+    } else if (c == '<' && i + 1 < html.len && char_is_alpha(html.str[i+1])) {
+      s64 end = i + 1;
+      for (u8 q = 0; end < html.len && (q || html.str[end] != '>'); end++) {
+        u8 e = html.str[end];
+        q = q? (e == q? 0 : q) : ((e == '\'' || e == '"')? e : 0);
+      }
+      end = MIN(end + 1, html.len);
+      str tag = { html.str + i, end - i };
+
+      if (critical.str && tag_is(html, i + 1, strl("link"))
+          && tag_has(tag, strl("stylesheet")) && tag_has(tag, strl("/style.css"))) {
+        append(out, html.str + run, i - run);
+        append_strl(out, "<style>");
+        append_str(out, critical);
+        append_strl(out, "</style><link rel='preload' href='/style.css' as='style' onload=\"this.onload=null;this.rel='stylesheet'\">"
+                         "<noscript><link rel='stylesheet' href='/style.css'></noscript>");
+        i = run = end;
+        continue;
+      }
 
-          append_strl(&out, "<li><a href='#");
-          append_str(&out, b->id);
-          append_strl(&out, "'>");
-          append_html_inline(&out, b->text);
-          append_strl(&out, "</a></li>\n");
+      // whitespace between attributes collapses, quoted values are kept
+      for (u8 q = 0; i < end; ) {
+        u8 e = html.str[i];
+        if (!q && char_is_whitespace(e)) {
+          append(out, html.str + run, i - run);
+          i = run = append_space(out, html, i);
+        } else {
+          q = q? (e == q? 0 : q) : ((e == '\'' || e == '"')? e : 0);
+          i++;
         }
       }
-      for (; toc_level >= toc_first; toc_level--)
-        append_strl(&out, "</ul>\n");
-      append_strl(&out, "<hr>\n");
 
-      for (Block *b = first; b; b = b->next) {
-        append_html(&out, b);
+      s32 r = 0;
+      for (; r < raws && !tag_is(tag, 1, raw[r]); r++);
+      if (r < raws) {
+        // kept as is up to the closing tag
+        for (; i < html.len; i++) {
+          if (html.str[i] == '<' && i + 1 < html.len && html.str[i+1] == '/' && tag_is(html, i + 2, raw[r])) break;
+        }
       }
 
-      append_strl(&out, "<hr><p class='centert'>Feel free to email me any comments about this article: <code>contact@loganforman.com</code></p>" );
-      append_str(&out, footer);
-      
-      char filename[256];
-      snprintf(filename, sizeof(filename), "../../docs/writing/%.*s.html", (s32)name.len, name.str);
-      ASSERT(!write_file(filename, out.buf, out.len), "ERR: failed to write %s!", filename);
+    } else {
+      i++;
+    }
+  }
+  append(out, html.str + run, i - run);
+}
+
+// Writes a page to docs/ or the pack, returns true on failure
+bool emit_page(Site *site, Arena *a, const char *path, str body, bool wrap) {
+  if (wrap && site->minify) {
+    str part[3] = { site->header, body, site->footer };
+    PageNames names = {};
+    for (s32 i = 0; i < 3; i++) {
+      collect_names(&names, part[i]);
+    }
+
+    Buf css = {};
+    css.cap = site->style.len + 64;
+    css.buf = Arena_bytes(a, css.cap);
+    append_used_css(&css, &names, site->style);
+    str critical = css.err || css.len > CRITICAL_CSS_MAX? (str){} : (str){ css.buf, css.len };
+
+    Buf page = {};
+    page.cap = site->header.len + body.len + site->footer.len + critical.len + 512;
+    page.buf = Arena_bytes(a, page.cap);
+    for (s32 i = 0; i < 3; i++) {
+      append_minified(&page, part[i], critical);
     }
+    if (page.err) {
+      return true;
+    }
+    body = (str){ page.buf, page.len };
+    wrap = false;
   }
 
-  append_strl(&rss, "</channel>\n</rss>\n");
+  if (site->golden >= 0) {
+    str part[3] = { wrap? site->header : (str){}, body, wrap? site->footer : (str){} };
+    str want = read_file(a, site->golden, path);
+    bool same = want.len == part[0].len + part[1].len + part[2].len;
+    for (s32 i = 0, at = 0; same && i < 3; at += part[i++].len) {
+      same = memcmp(want.str + at, part[i].str, part[i].len) == 0;
+    }
+    if (!same) {
+      fprintf(stderr, "%s: differs from golden output\n", path);
+      site->mismatches++;
+    }
+    return false;
+  }
 
-  write_file("../../docs/rss.xml", rss.buf, rss.len);
+  if (site->pack >= 0) {
+    ASSERT(site->entries < site->entries_cap, "ERR: too many pages!");
+    PackEntry *e = &site->entry[site->entries++];
+    memset(e, 0, sizeof(*e));
+    snprintf(e->path, sizeof(e->path), "%s", path);
+    if (site->log) {
+      append(site->log, (u8*) path, strlen(path));
+      append_strl(site->log, "\n");
+    }
+    e->wrap = wrap;
+    e->off = site->pack_len;
+    e->len = body.len;
+    site->pack_len += body.len;
+    return pwrite(site->pack, body.str, body.len, e->off) != body.len;
+  }
 
-  append_strl(&blog, "</table>");
-  append_str(&blog, footer);
-  write_file("../../docs/blog.html", blog.buf, blog.len);
+  if (site->log) {
+    append(site->log, (u8*) path, strlen(path));
+    append_strl(site->log, "\n");
+  }
 
-  ASSERT(chdir("..") == 0, "ERR: failed to chdir!");
-  {
-    DIR *dir = opendir(".");
-    for (struct dirent* f; (f = readdir(dir)); ) ARENA_TEMP(a) {
-      if (f->d_type != DT_REG) continue;
-      out.len = 0;
+  if (wrap) {
+    str part[3] = { site->header, body, site->footer };
+    return write_filev(site->docs, path, part, 3);
+  } else {
+    return write_filev(site->docs, path, &body, 1);
+  }
+}
+
+const char *content_type(str path) {
+  if (str_endl(path, ".html")) return "text/html; charset=utf-8";
+  if (str_endl(path, ".xml"))  return "application/rss+xml";
+  if (str_endl(path, ".json")) return "application/json";
+  if (str_endl(path, ".css"))  return "text/css";
+  if (str_endl(path, ".png"))  return "image/png";
+  if (str_endl(path, ".gif"))  return "image/gif";
+  if (str_endl(path, ".ico"))  return "image/x-icon";
+  if (str_endl(path, ".mp4"))  return "video/mp4";
+  if (str_endl(path, ".woff")) return "font/woff";
+  if (str_endl(path, ".ttf"))  return "font/ttf";
+  return "application/octet-stream";
+}
+
+void send_range(int out, int in, off_t off, s64 len) {
+  while (len > 0) {
+    ssize_t n = sendfile(out, in, &off, len);
+    if (n <= 0) {
+      break;
+    }
+    len -= n;
+  }
+}
 
-      str md = read_file(&a, f->d_name);
-      str name = str_trim(strc(f->d_name), 3);
-      Block *first = parse_md(&a, md);
+void send_status(int c, const char *status, const char *type, s64 len) {
+  char h[256];
+  s32 n = snprintf(h, sizeof(h),
+    "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %lld\r\nConnection: close\r\n\r\n",
+    status, type, (long long) len);
+  write(c, h, n);
+}
 
-      append_str(&out, header);
-      append_strl(&out, "<title> 0A ");
-      append_str(&out, name);
-      append_strl(&out, "</title>\n");
-      for (Block *b = first; b; b = b->next) {
-        append_html(&out, b);
+// NOTE(lf) Local stand-in for the real host, only meant for previewing a pack.
+void serve(Arena *a, int docs, u16 port) {
+  int pack = openat(docs, PACK_NAME, O_RDONLY);
+  ASSERT(pack >= 0, "ERR: no %s, run `site pack` first!", PACK_NAME);
+
+  PackHeader h;
+  ASSERT(pread(pack, &h, sizeof(h), 0) == sizeof(h) && h.magic == PACK_MAGIC, "ERR: bad pack!");
+  PackEntry *entry = Arena_array(a, PackEntry, h.count);
+  s64 index_len = h.count*sizeof(PackEntry);
+  ASSERT(pread(pack, entry, index_len, h.index) == index_len, "ERR: bad pack index!");
+
+  int s = socket(AF_INET, SOCK_STREAM, 0);
+  int yes = 1;
+  setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  struct sockaddr_in addr = {
+    .sin_family = AF_INET,
+    .sin_port = htons(port),
+    .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+  };
+  ASSERT(bind(s, (struct sockaddr*) &addr, sizeof(addr)) == 0, "ERR: failed to bind port %d!", port);
+  ASSERT(listen(s, 64) == 0, "ERR: failed to listen!");
+  signal(SIGPIPE, SIG_IGN);
+  printf("serving %d pages on http://127.0.0.1:%d/\n", h.count, port);
+
+  for (int c; (c = accept(s, 0, 0)) >= 0; close(c)) {
+    char req[4096];
+    ssize_t n = read(c, req, sizeof(req));
+    str line = { (u8*) req, MAX(n, 0) };
+    line = str_cut_char(&line, '\n');
+    if (!str_startl(line, "GET /")) {
+      send_status(c, "405 Method Not Allowed", "text/plain", 0);
+      continue;
+    }
+    line = str_skip(line, 5);
+    str path = str_cut_char(&line, ' ');
+    path = str_cut_char(&path, '?');
+
+    char name[sizeof(entry->path)];
+    snprintf(name, sizeof(name), "%.*s%s", (s32) path.len, path.str,
+             (path.len == 0 || str_endl(path, "/"))? "index.html" : "");
+
+    PackEntry key = {};
+    memcpy(key.path, name, sizeof(name));
+    PackEntry *e = bsearch(&key, entry, h.count, sizeof(PackEntry), pack_entry_cmp);
+    const char *status = "200 OK";
+    if (!e) {
+      // relative to docs only: openat ignores the dir for absolute paths
+      bool inside = name[0] != '/' && strstr(name, "..") == 0;
+      int fd = inside? openat(docs, name, O_RDONLY | O_NOFOLLOW) : -1;
+      struct stat st;
+      if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        send_status(c, status, content_type(strc(name)), st.st_size);
+        send_range(c, fd, 0, st.st_size);
+        close(fd);
+        continue;
+      }
+      if (fd >= 0) {
+        close(fd);
       }
-      append_str(&out, footer);
 
-      char filename[256];
-      snprintf(filename, sizeof(filename), "../docs/%.*s.html", (s32)name.len, name.str);
-      ASSERT(!write_file(filename, out.buf, out.len), "ERR: failed to write %s!", filename);
+      status = "404 Not Found";
+      memcpy(key.path, "404.html", sizeof("404.html"));
+      e = bsearch(&key, entry, h.count, sizeof(PackEntry), pack_entry_cmp);
+      if (!e) {
+        send_status(c, status, "text/plain", 0);
+        continue;
+      }
     }
-    closedir(dir);
+
+    s64 len = e->len + (e->wrap? h.header_len + h.footer_len : 0);
+    send_status(c, status, content_type(strc(e->path)), len);
+    if (e->wrap) {
+      send_range(c, pack, h.header_off, h.header_len);
+    }
+    send_range(c, pack, e->off, e->len);
+    if (e->wrap) {
+      send_range(c, pack, h.footer_off, h.footer_len);
+    }
+  }
+}
+
+#define HASH_SEED 0xcbf29ce484222325
+u64 hash_bytes(u64 h, u8 *data, s64 len) { // FNV-1a
+  for (s64 i = 0; i < len; i++) {
+    h = (h ^ data[i])*0x100000001b3;
   }
+  return h;
+}
 
-  return 0;
+s64 stat_mtime(struct stat *st) {
+  return st->st_mtim.tv_sec*1000000000ll + st->st_mtim.tv_nsec;
 }
 
+// re-reads the templates if any changed, marking every page dirty
+void load_templates(Site *site) {
+  const char *path[4] = { "src/header.html", "src/footer.html", "src/rss-header.xml", "docs/style.css" };
+  s32 paths = site->minify? 4 : 3;
+  s64 mtime = 0;
+  for (s32 i = 0; i < paths; i++) {
+    struct stat st;
+    if (stat(path[i], &st) == 0) {
+      mtime ^= stat_mtime(&st) + i;
+    }
+  }
+  if (site->templates.buf && mtime == site->templates_mtime) {
+    return;
+  }
+
+  if (!site->templates.buf) {
+    site->templates = Arena_alloc((Arena){ .size = MB(4) });
+  }
+  site->templates.pos = 0;
+  site->header = read_file(&site->templates, AT_FDCWD, path[0]);
+  site->footer = read_file(&site->templates, AT_FDCWD, path[1]);
+  site->rss_header = read_file(&site->templates, AT_FDCWD, path[2]);
+  site->style = site->minify? read_file(&site->templates, AT_FDCWD, path[3]) : (str){};
+  site->templates_mtime = mtime;
+  site->templates_dirty = true;
+}
+
+// blog.html row and rss.xml item for an article, cached until its frontmatter changes
+void build_fragments(Site *site, Cached *c) {
+  str name = c->opt.name;
+  Frontmatter *m = &c->page.meta;
+  u64 h = HASH_SEED;
+  h = hash_bytes(h, name.str, name.len);
+  h = hash_bytes(h, m->title.str, m->title.len) ^ 1;
+  h = hash_bytes(h, m->date.str, m->date.len) ^ 2;
+  h = hash_bytes(h, m->desc.str, m->desc.len) ^ 3;
+  if (c->blog_row.str && h == c->meta_hash) {
+    return;
+  }
+  c->meta_hash = h;
+
+  Buf b = {};
+  b.cap = 6*(4*name.len + 2*m->title.len + 2*m->date.len + 2*m->desc.len) + 512;
+  b.buf = Arena_bytes(&site->cache, b.cap);
+
+  append_strl(&b, "<item>\n<title>");
+  append_escaped(&b, m->title, ESC_ATTR);
+  append_strl(&b, "</title>\n<description>");
+  append_escaped(&b, m->desc, ESC_ATTR);
+  append_strl(&b, "</description>\n<link>https://loganforman.com/writing/");
+  append_escaped(&b, name, ESC_ATTR);
+  append_strl(&b, ".html</link>\n<guid>https://loganforman.com/writing/");
+  append_escaped(&b, name, ESC_ATTR);
+  append_strl(&b, ".html</guid>\n<pubDate>");
+  append_escaped(&b, m->date, ESC_ATTR);
+  append_strl(&b, "</pubDate>\n</item>\n");
+  c->rss_item = (str){ b.buf, b.len };
+
+  s32 start = b.len;
+  append_strl(&b, "<tr><td><code>");
+  append_escaped(&b, str_first(str_skip(m->date, 6), 11), ESC_TEXT);
+  append_strl(&b, "</code></td>\n<td><a href='/writing/");
+  append_escaped(&b, name, ESC_ATTR);
+  append_strl(&b, ".html'>");
+  append_escaped(&b, m->title, ESC_MARKUP);
+  append_strl(&b, "</a></td>\n<td>");
+  append_escaped(&b, m->desc, ESC_MARKUP);
+  append_strl(&b, "</td>\n</tr>\n");
+  c->blog_row = (str){ b.buf + start, b.len - start };
+}
+
+void cache_reset(Site *site) {
+  if (!site->cache.buf) {
+    site->cache = Arena_alloc((Arena){ .size = MB(1024) });
+  }
+  site->cache.pos = 0;
+  site->index_files = 0;
+  site->cached_cap = 8192;
+  site->cached = Arena_array(&site->cache, Cached, site->cached_cap);
+  site->slot = Arena_array(&site->cache, s32, 2*site->cached_cap);
+  memset(site->slot, 0xFF, 2*site->cached_cap*sizeof(s32));
+  site->cached_len = 0;
+}
+
+/* NOTE(lf) With --cache <dir>, parsed pages are also kept on disk, so a
+   fresh process can skip parse_md for sources it has seen before. A file holds
+   an AstHeader, then the blocks, then the text nodes. Links are 1-based
+   indices that only point forward (0 for none) and strings are offsets
+   into the source, so the file doesn't depend on where it is loaded or on
+   the arena the page was parsed into. It's only used when the hash of the
+   source, the page kind and AST_VERSION all match.
+*/
+#define AST_MAGIC 0x54534130 // "0AST"
+#define AST_VERSION 2       // bump when the parser or node layout changes
+
+typedef struct AstSpan AstSpan;
+struct AstSpan {
+  u32 off;
+  s32 len;
+};
+
+typedef struct AstHeader AstHeader;
+struct AstHeader {
+  u32 magic;
+  u32 version;
+  u64 hash;     // of the source
+  u64 check;    // of the nodes
+  u32 src_len;
+  u32 blocks;
+  u32 texts;
+  u32 pad;
+  AstSpan title;
+  AstSpan date;
+  AstSpan desc;
+};
+
+typedef struct AstBlock AstBlock;
+struct AstBlock {
+  u32 next;
+  u32 text;
+  u32 type;
+  s32 num;
+  AstSpan id;
+};
+
+typedef struct AstText AstText;
+struct AstText {
+  u32 next;
+  u32 child;
+  u32 type;
+  AstSpan s;
+};
+
+typedef struct AstWriter AstWriter;
+struct AstWriter {
+  str src;
+  AstText *text;
+  u32 texts;
+  u32 cap;
+  bool err;     // a string outside src, or too many nodes
+};
+
+u64 ast_hash(str md, RenderOptions *opt) {
+  u64 h = HASH_SEED ^ AST_VERSION ^ ((u64) opt->article << 32);
+  return hash_bytes(h, md.str, md.len);
+}
+
+AstSpan ast_span(AstWriter *w, str s) {
+  if (s.len == 0) {
+    return (AstSpan){};
+  }
+  if (s.str < w->src.str || s.str + MAX(s.len, 0) > w->src.str + w->src.len) {
+    w->err = true;
+    return (AstSpan){};
+  }
+  return (AstSpan){ s.str - w->src.str, s.len };
+}
+
+str ast_str(str src, AstSpan s) {
+  return s.len? (str){ src.str + s.off, s.len } : (str){};
+}
+
+bool ast_span_ok(AstSpan s, u32 src_len) {
+  return s.len == 0 || (s.off <= src_len && s.off + MAX(s.len, 0) <= (u64) src_len);
+}
+
+u32 ast_count(Text *t) {
+  u32 n = 0;
+  for (; t; t = t->next) {
+    n += 1 + ast_count(t->child);
+  }
+  return n;
+}
+
+// Writes the list starting at t, returning the index of its first node.
+// Only recurses into children, which the inline parser keeps shallow.
+u32 ast_put(AstWriter *w, Text *t) {
+  u32 first = 0;
+  u32 prev = 0;
+  for (; t && !w->err; t = t->next) {
+    if (w->texts == w->cap) {
+      w->err = true;
+      break;
+    }
+    u32 at = ++w->texts;
+    if (prev) w->text[prev-1].next = at; else first = at;
+    w->text[at-1] = (AstText){ .type = t->type, .s = ast_span(w, t->s) };
+    w->text[at-1].child = ast_put(w, t->child);
+    prev = at;
+  }
+  return first;
+}
+
+// Saves page, parsed from md, as the cached AST for path.
+void ast_store(Site *site, Arena *a, str path, str md, RenderOptions *opt, Page *page) {
+  if (site->ast_dir < 0 || md.len > 0x7FFFFFFF) {
+    return;
+  }
+
+  ARENA_TEMP(*a) {
+    u32 blocks = 0, texts = 0;
+    for (Block *b = page->first; b; b = b->next) {
+      blocks++;
+      texts += ast_count(b->text);
+    }
+
+    AstWriter w = { .src = md, .cap = texts };
+    w.text = Arena_array(a, AstText, MAX(texts, 1));
+    AstBlock *block = Arena_array(a, AstBlock, MAX(blocks, 1));
+    u32 i = 0;
+    for (Block *b = page->first; b; b = b->next, i++) {
+      block[i] = (AstBlock){
+        .next = b->next? i + 2 : 0,
+        .text = ast_put(&w, b->text),
+        .type = b->type,
+        .num = b->num,
+        .id = ast_span(&w, b->id),
+      };
+    }
+
+    AstHeader h = {
+      .magic = AST_MAGIC,
+      .version = AST_VERSION,
+      .hash = ast_hash(md, opt),
+      .check = hash_bytes(hash_bytes(HASH_SEED, (u8*) block, blocks*sizeof(AstBlock)), (u8*) w.text, w.texts*sizeof(AstText)),
+      .src_len = md.len,
+      .blocks = blocks,
+      .texts = w.texts,
+      .title = ast_span(&w, page->meta.title),
+      .date = ast_span(&w, page->meta.date),
+      .desc = ast_span(&w, page->meta.desc),
+    };
+
+    if (!w.err) {
+      char name[256], tmp[264];
+      snprintf(name, sizeof(name), "%.*s.ast", (s32) path.len, path.str);
+      for (char *c = name; *c; c++) if (*c == '/') *c = '-';
+      snprintf(tmp, sizeof(tmp), "%s.tmp", name);
+
+      str part[3] = {
+        { (u8*) &h, sizeof(h) },
+        { (u8*) block, blocks*sizeof(AstBlock) },
+        { (u8*) w.text, w.texts*sizeof(AstText) },
+      };
+      if (write_filev(site->ast_dir, tmp, part, 3) || renameat(site->ast_dir, tmp, site->ast_dir, name) != 0) {
+        unlinkat(site->ast_dir, tmp, 0);
+      }
+    }
+  }
+}
+
+// Loads the cached AST for path into page if it was saved from md.
+// Strings in the page point into md. Returns false on a miss.
+bool ast_load(Site *site, Arena *a, str path, str md, RenderOptions *opt, Page *page) {
+  if (site->ast_dir < 0) {
+    return false;
+  }
+
+  char name[256];
+  snprintf(name, sizeof(name), "%.*s.ast", (s32) path.len, path.str);
+  for (char *c = name; *c; c++) if (*c == '/') *c = '-';
+  int fd = openat(site->ast_dir, name, O_RDONLY);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (s64) sizeof(AstHeader)) {
+    if (fd >= 0) close(fd);
+    return false;
+  }
+  u8 *map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+
+  AstHeader h;
+  memcpy(&h, map, sizeof(h));
+  bool ok = h.magic == AST_MAGIC && h.version == AST_VERSION
+    && h.src_len == md.len && h.hash == ast_hash(md, opt)
+    && st.st_size == (s64) (sizeof(h) + (u64) h.blocks*sizeof(AstBlock) + (u64) h.texts*sizeof(AstText))
+    && ast_span_ok(h.title, h.src_len) && ast_span_ok(h.date, h.src_len) && ast_span_ok(h.desc, h.src_len)
+    && h.check == hash_bytes(HASH_SEED, map + sizeof(h), st.st_size - sizeof(h));
+
+  AstBlock *ab = (AstBlock*) (map + sizeof(h));
+  AstText *at = (AstText*) (ab + h.blocks);
+  for (u32 i = 0; ok && i < h.blocks; i++) {
+    ok = (ab[i].next == 0 || (ab[i].next > i + 1 && ab[i].next <= h.blocks))
+      && ab[i].text <= h.texts && ast_span_ok(ab[i].id, h.src_len)
+      && ab[i].type <= UN_LIST; // 0 for the empty blocks blank lines leave
+  }
+  for (u32 i = 0; ok && i < h.texts; i++) {
+    ok = (at[i].next == 0 || (at[i].next > i + 1 && at[i].next <= h.texts))
+      && (at[i].child == 0 || (at[i].child > i + 1 && at[i].child <= h.texts))
+      && ast_span_ok(at[i].s, h.src_len)
+      && at[i].type < TEXT_STYLES;
+  }
+
+  // The parser only makes trees no deeper than its inline stack, so reject
+  // a node reached twice or nested deeper. Links point forward, so one pass
+  // in order sees every parent before its children.
+  ARENA_TEMP(*a) {
+    u8 *depth = Arena_bytes(a, MAX(h.texts, 1)); // 0 until reached, 1 for lines
+    memset(depth, 0, MAX(h.texts, 1));
+    for (u32 i = 0; ok && i < h.blocks; i++) {
+      if (ab[i].text) {
+        ok = depth[ab[i].text - 1] == 0;
+        depth[ab[i].text - 1] = 1;
+      }
+    }
+    for (u32 i = 0; ok && i < h.texts; i++) {
+      if (depth[i] && at[i].next) {
+        ok = depth[at[i].next - 1] == 0;
+        depth[at[i].next - 1] = depth[i];
+      }
+      if (ok && depth[i] && at[i].child) {
+        ok = depth[at[i].child - 1] == 0 && depth[i] < INLINE_MAX_DEPTH;
+        depth[at[i].child - 1] = depth[i] + 1;
+      }
+    }
+  }
+
+  if (ok) {
+    Block *block = Arena_array(a, Block, MAX(h.blocks, 1));
+    Text *text = Arena_array(a, Text, MAX(h.texts, 1));
+    for (u32 i = 0; i < h.texts; i++) {
+      text[i] = (Text){
+        .next = at[i].next? &text[at[i].next - 1] : 0,
+        .child = at[i].child? &text[at[i].child - 1] : 0,
+        .type = at[i].type,
+        .s = ast_str(md, at[i].s),
+      };
+    }
+    for (u32 i = 0; i < h.blocks; i++) {
+      block[i] = (Block){
+        .next = ab[i].next? &block[ab[i].next - 1] : 0,
+        .type = ab[i].type,
+        .num = ab[i].num,
+        .id = ast_str(md, ab[i].id),
+        .text = ab[i].text? &text[ab[i].text - 1] : 0,
+      };
+    }
+    page->first = h.blocks? block : 0;
+    page->meta = (Frontmatter){ ast_str(md, h.title), ast_str(md, h.date), ast_str(md, h.desc) };
+  }
+
+  munmap(map, st.st_size);
+  return ok;
+}
+
+// Finds or adds the entry for path, setting fresh if it was loaded from
+// the file as it is now.
+Cached *cache_entry(Site *site, str path, struct stat *st, bool *fresh) {
+  if (!site->cache.buf) {
+    cache_reset(site);
+  }
+
+  s32 mask = 2*site->cached_cap - 1;
+  s32 i = hash_bytes(HASH_SEED, path.str, path.len) & mask;
+  for (; site->slot[i] >= 0; i = (i + 1) & mask) {
+    Cached *c = &site->cached[site->slot[i]];
+    if (str_eq(c->path, path)) {
+      *fresh = c->mtime == stat_mtime(st) && c->size == st->st_size;
+      return c;
+    }
+  }
+
+  ASSERT(site->cached_len < site->cached_cap, "ERR: too many pages!");
+  site->slot[i] = site->cached_len;
+  Cached *c = &site->cached[site->cached_len++];
+  memset(c, 0, sizeof(*c));
+  c->path = str_copy(&site->cache, path);
+
+  str name = path;
+  bool article = str_startl(name, "writing/");
+  if (article) {
+    name = str_skip(name, strl("writing/").len + 4);
+  }
+  name = str_trim(name, 3);
+  c->opt.name = name;
+  c->opt.path = c->path;
+  c->opt.article = article;
+  c->out.len = name.len + strl(".html").len + (article? strl("writing/").len : 0);
+  c->out.str = Arena_bytes(&site->cache, c->out.len + 1);
+  snprintf((char*) c->out.str, c->out.len + 1, "%s%.*s.html",
+           article? "writing/" : "", (s32) name.len, name.str);
+
+  *fresh = false;
+  return c;
+}
+
+// Returns the parsed page at path (relative to pages/), re-parsing only if
+// the file changed since it was last loaded. Returns 0 if it can't be read.
+Cached *load_page(Site *site, str path) {
+  char cpath[256];
+  snprintf(cpath, sizeof(cpath), "%.*s", (s32) path.len, path.str);
+  struct stat st;
+  if (fstatat(site->pages, cpath, &st, 0) != 0 || !S_ISREG(st.st_mode)) {
+    return 0;
+  }
+
+  bool fresh;
+  Cached *c = cache_entry(site, path, &st, &fresh);
+  if (fresh && c->parsed) {
+    return c;
+  }
+
+  str md = read_file(&site->cache, site->pages, cpath);
+  c->mtime = stat_mtime(&st);
+  c->size = st.st_size;
+  c->dirty = true;
+  c->parsed = true;
+  if (!ast_load(site, &site->cache, path, md, &c->opt, &c->page)) {
+    c->page = parse_page(&site->cache, md, &c->opt);
+    ast_store(site, &site->cache, path, md, &c->opt, &c->page);
+  }
+  if (c->opt.article) {
+    build_fragments(site, c);
+  }
+  return c;
+}
+
+// Same as load_page for an article, but reads and parses only its
+// frontmatter. The body is parsed when the page is loaded to be rendered.
+Cached *load_meta(Site *site, str path) {
+  char cpath[256];
+  snprintf(cpath, sizeof(cpath), "%.*s", (s32) path.len, path.str);
+  struct stat st;
+  if (fstatat(site->pages, cpath, &st, 0) != 0 || !S_ISREG(st.st_mode)) {
+    return 0;
+  }
+
+  bool fresh;
+  Cached *c = cache_entry(site, path, &st, &fresh);
+  if (fresh) {
+    return c;
+  }
+
+  str md = read_frontmatter(&site->cache, site->pages, cpath);
+  c->mtime = stat_mtime(&st);
+  c->size = st.st_size;
+  c->dirty = true;
+  c->parsed = false;
+  c->page = (Page){ .meta = parse_frontmatter(&md) };
+  build_fragments(site, c);
+  return c;
+}
+
+str render_cached(Site *site, Arena *a, Cached *c, bool wrap) {
+  RenderOptions opt = c->opt;
+  if (wrap) {
+    opt.header = site->header;
+    opt.footer = site->footer;
+  }
+  return render_parsed(a, &c->page, &opt);
+}
+
+// True if the index file at path was last written from different inputs.
+bool index_changed(Site *site, const char *path, u64 h) {
+  u64 name = hash_bytes(HASH_SEED, (u8*) path, strlen(path));
+  s32 i = 0;
+  for (; i < site->index_files && site->index_file[i].name != name; i++);
+  if (i == site->index_files) {
+    if (i == INDEX_FILES) {
+      return true;
+    }
+    site->index_file[site->index_files++] = (IndexFile){ name, ~h };
+  }
+  bool changed = site->index_file[i].hash != h;
+  site->index_file[i].hash = h;
+  if (!changed && site->pack < 0 && site->golden < 0) {
+    // the table can outlive the file, kept in --cache or by the daemon
+    changed = faccessat(site->docs, path, F_OK, 0) != 0;
+  }
+  return changed;
+}
+
+// With --cache the index table is kept there too, so a batch run skips
+// the index files the last run wrote from the same fragments.
+void index_load(Site *site) {
+  if (site->ast_dir < 0 || site->pack >= 0 || site->golden >= 0 || site->index_files > 0) {
+    return;
+  }
+  int fd = openat(site->ast_dir, "index.hashes", O_RDONLY);
+  if (fd >= 0) {
+    ssize_t n = read(fd, site->index_file, sizeof(site->index_file));
+    site->index_files = n > 0 && n % sizeof(IndexFile) == 0? n/sizeof(IndexFile) : 0;
+    close(fd);
+  }
+}
+
+void index_save(Site *site) {
+  if (site->ast_dir < 0 || site->pack >= 0 || site->golden >= 0) {
+    return;
+  }
+  str part = { (u8*) site->index_file, site->index_files*sizeof(IndexFile) };
+  if (write_filev(site->ast_dir, "index.hashes.tmp", &part, 1)
+      || renameat(site->ast_dir, "index.hashes.tmp", site->ast_dir, "index.hashes") != 0) {
+    unlinkat(site->ast_dir, "index.hashes.tmp", 0);
+  }
+}
+
+// Removes blog-page-N.html past pages and blog-<year>.html for years not
+// in year[0..years), left in docs/ when the archive shrinks.
+void remove_stale_shards(Site *site, s32 pages, s32 *year, s32 years) {
+  if (site->pack >= 0 || site->golden >= 0) {
+    return;
+  }
+  DIR *dir = fdopendir(dup(site->docs));
+  rewinddir(dir);
+  for (struct dirent* f; (f = readdir(dir)); ) {
+    s32 n = 0, end = 0;
+    bool stale = false;
+    if (sscanf(f->d_name, "blog-page-%d.html%n", &n, &end) == 1 && f->d_name[end] == 0) {
+      stale = n > pages;
+    } else if (sscanf(f->d_name, "blog-%4d.html%n", &n, &end) == 1 && f->d_name[end] == 0 && end == 14) {
+      stale = true;
+      for (s32 i = 0; i < years && stale; i++) {
+        stale = year[i] != n;
+      }
+    } else {
+      stale = site->blog_page <= 0 && strcmp(f->d_name, "blog.json") == 0;
+    }
+
+    if (stale && unlinkat(site->docs, f->d_name, 0) == 0) {
+      // written again if it comes back, even with the same contents
+      u64 name = hash_bytes(HASH_SEED, (u8*) f->d_name, strlen(f->d_name));
+      for (s32 i = 0; i < site->index_files; i++) {
+        if (site->index_file[i].name == name) {
+          site->index_file[i].hash = ~site->index_file[i].hash;
+        }
+      }
+    }
+  }
+  closedir(dir);
+}
+
+// Year from an rss date, "Sat, 22 Feb 2026 10:25:00 MST", or 0.
+s32 article_year(Cached *c) {
+  str date = c->page.meta.date;
+  for (s32 i = 0; i < 3; i++) {
+    str_cut_char(&date, ' ');
+  }
+  str year = str_cut_char(&date, ' ');
+  s32 y = 0;
+  for (s64 i = 0; i < year.len && char_is_num(year.str[i]); i++) {
+    y = 10*y + year.str[i] - '0';
+  }
+  return year.len == 4? y : 0;
+}
+
+// Writes one blog.html style page listing article[0..articles), followed
+// by nav, skipping it when neither changed.
+void emit_blog_page(Site *site, Arena *a, const char *path, Cached **article, s32 articles, str nav) {
+  u64 h = hash_bytes(HASH_SEED ^ articles, (u8*) &site->templates_mtime, sizeof(s64));
+  h = hash_bytes(h, nav.str, nav.len);
+  for (s32 i = 0; i < articles; i++) {
+    h = hash_bytes(h, (u8*) &article[i]->meta_hash, sizeof(u64));
+  }
+  if (!index_changed(site, path, h)) {
+    return;
+  }
+
+  ARENA_TEMP(*a) {
+    Buf blog = {};
+    blog.cap = MB(2);
+    blog.buf = Arena_bytes(a, blog.cap);
+    append_strl(&blog, "<p><div class='center'> <img src='/assets/dd.png' /></div></p>\n");
+    append_strl(&blog, "<h2 id='center'>Logan Forman <a href='https://www.twitter.com/dev_dwarf'>@dev dwarf</a></h2>");
+    append_strl(&blog, "<table><th>Date<th>Title<th style='width: 50%'>Description\n");
+    for (s32 i = 0; i < articles; i++) {
+      append_str(&blog, article[i]->blog_row);
+    }
+    append_strl(&blog, "</table>");
+    append_str(&blog, nav);
+    ASSERT(!blog.err && !emit_page(site, a, path, (str){ blog.buf, blog.len }, true), "ERR: failed to write %s!", path);
+  }
+}
+
+/* NOTE(lf) blog.html and rss.xml are spliced from the cached article
+   fragments. Each file is skipped when the fragments it lists and the
+   templates are the same as when it was last written, and it is still in
+   docs/. With --cache that is remembered across runs, not just in the
+   daemon.
+   With --blog-page N the listing is split for large archives:
+     blog.html, blog-page-2.html ...  N articles each, newest first,
+                                      linked with newer/older
+     blog-<year>.html                 every article from that year,
+                                      linked with the neighbouring years
+     blog.json                        the pages and years above
+   Pages and years that are no longer produced are removed from docs/.
+*/
+void build_index(Site *site, Arena *a, Cached **article, s32 articles) {
+  s32 items = site->rss_items > 0? MIN(site->rss_items, articles) : articles;
+  u64 h = hash_bytes(HASH_SEED ^ items, (u8*) &site->templates_mtime, sizeof(s64));
+  for (s32 i = 0; i < items; i++) {
+    h = hash_bytes(h, (u8*) &article[i]->meta_hash, sizeof(u64));
+  }
+  if (index_changed(site, "rss.xml", h)) ARENA_TEMP(*a) {
+    Buf rss = {};
+    rss.cap = MB(2);
+    rss.buf = Arena_bytes(a, rss.cap);
+    append_str(&rss, site->rss_header);
+    for (s32 i = 0; i < items; i++) {
+      append_str(&rss, article[i]->rss_item);
+    }
+    append_strl(&rss, "</channel>\n</rss>\n");
+    ASSERT(!rss.err && !emit_page(site, a, "rss.xml", (str){ rss.buf, rss.len }, false), "ERR: failed to write rss.xml!");
+  }
+
+  s32 per_page = site->blog_page > 0? site->blog_page : MAX(articles, 1);
+  s32 pages = MAX((articles + per_page - 1)/per_page, 1);
+  char path[64], link[256];
+  for (s32 p = 0; p < pages; p++) {
+    Buf nav = {};
+    nav.cap = sizeof(link);
+    nav.buf = (u8*) link;
+    if (pages > 1) {
+      append_strl(&nav, "<p class='centert'>");
+      if (p > 0) {
+        snprintf(path, sizeof(path), p == 1? "blog.html" : "blog-page-%d.html", p);
+        nav.len += snprintf((char*) nav.buf + nav.len, nav.cap - nav.len, "<a href='/%s'>newer</a>", path);
+      }
+      if (p + 1 < pages) {
+        nav.len += snprintf((char*) nav.buf + nav.len, nav.cap - nav.len, "%s<a href='/blog-page-%d.html'>older</a>", p? " " : "", p + 2);
+      }
+      append_strl(&nav, "</p>");
+    }
+
+    snprintf(path, sizeof(path), p == 0? "blog.html" : "blog-page-%d.html", p + 1);
+    s32 first = p*per_page;
+    emit_blog_page(site, a, path, article + first, MIN(per_page, articles - first), (str){ nav.buf, nav.len });
+  }
+
+  if (site->blog_page <= 0) {
+    remove_stale_shards(site, pages, 0, 0);
+    return;
+  }
+
+  // articles are sorted by number, not date, so years are grouped by a sort
+  ARENA_TEMP(*a) {
+    Cached **by_year = Arena_array(a, Cached*, MAX(articles, 1));
+    s32 *year = Arena_array(a, s32, MAX(articles, 1));
+    for (s32 i = 0; i < articles; i++) {
+      s32 y = article_year(article[i]);
+      s32 j = i;
+      for (; j > 0 && year[j-1] < y; j--) {
+        year[j] = year[j-1];
+        by_year[j] = by_year[j-1];
+      }
+      year[j] = y;
+      by_year[j] = article[i];
+    }
+
+    Buf json = {};
+    json.cap = MB(1);
+    json.buf = Arena_bytes(a, json.cap);
+    json.len = snprintf((char*) json.buf, json.cap, "{\"articles\":%d,\"page_size\":%d,\"pages\":[", articles, per_page);
+    for (s32 p = 0; p < pages; p++) {
+      snprintf(path, sizeof(path), p == 0? "blog.html" : "blog-page-%d.html", p + 1);
+      json.len += snprintf((char*) json.buf + json.len, json.cap - json.len, "%s\"/%s\"", p? "," : "", path);
+      json.len = MIN(json.len, json.cap);
+    }
+    append_strl(&json, "],\"years\":[");
+
+    for (s32 i = 0; i < articles; ) {
+      s32 j = i;
+      for (; j < articles && year[j] == year[i]; j++);
+
+      Buf nav = {};
+      nav.cap = sizeof(link);
+      nav.buf = (u8*) link;
+      append_strl(&nav, "<p class='centert'>");
+      if (i > 0) {
+        nav.len += snprintf((char*) nav.buf + nav.len, nav.cap - nav.len, "<a href='/blog-%d.html'>%d</a> ", year[i-1], year[i-1]);
+      }
+      append_strl(&nav, "<a href='/blog.html'>latest</a>"); // blog.html is only the first page
+      if (j < articles) {
+        nav.len += snprintf((char*) nav.buf + nav.len, nav.cap - nav.len, " <a href='/blog-%d.html'>%d</a>", year[j], year[j]);
+      }
+      append_strl(&nav, "</p>");
+
+      snprintf(path, sizeof(path), "blog-%d.html", year[i]);
+      emit_blog_page(site, a, path, by_year + i, j - i, (str){ nav.buf, nav.len });
+
+      json.len += snprintf((char*) json.buf + json.len, json.cap - json.len, "%s{\"year\":%d,\"articles\":%d,\"url\":\"/%s\"}",
+                           i? "," : "", year[i], j - i, path);
+      json.len = MIN(json.len, json.cap);
+      i = j;
+    }
+    append_strl(&json, "]}\n");
+
+    str manifest = { json.buf, json.len };
+    if (index_changed(site, "blog.json", hash_bytes(HASH_SEED, manifest.str, manifest.len))) {
+      ASSERT(!json.err && !emit_page(site, a, "blog.json", manifest, false), "ERR: failed to write blog.json!");
+    }
+
+    remove_stale_shards(site, pages, year, articles);
+  }
+}
+
+// Article paths (relative to pages/), newest first by their number prefix.
+str *list_articles(Site *site, Arena *a, s32 *count) {
+  DIR *dir = fdopendir(dup(site->writing));
+  rewinddir(dir);
+  str *article = Arena_array(a, str, 4096);
+  s32 articles = 0;
+  for (struct dirent* f; (f = readdir(dir)); ) {
+    if (f->d_type != DT_REG) continue;
+    str name = strc(f->d_name);
+    if (!str_endl(name, ".md")) continue;
+
+    s32 i = 0;
+    for (; i < articles; i++) {
+      if (memcmp(article[i].str + 8, f->d_name, 3) <= 0) {
+        break;
+      }
+    }
+    for (s32 j = articles; j > i; j--) {
+      article[j] = article[j-1];
+    }
+    article[i] = str_sized(a, strl("writing/").len + name.len);
+    memcpy(article[i].str, "writing/", 8);
+    memcpy(article[i].str + 8, name.str, name.len);
+    articles++;
+  }
+  closedir(dir);
+  *count = articles;
+  return article;
+}
+
+// Writes blog.html and rss.xml if they changed, reading only frontmatter.
+void build_index_only(Site *site, Arena *a) {
+  if (site->cache.pos > site->cache.size/2) {
+    cache_reset(site);
+  }
+  load_templates(site);
+
+  ARENA_TEMP(*a) {
+    s32 articles;
+    str *article = list_articles(site, a, &articles);
+    Cached **article_page = Arena_array(a, Cached*, articles);
+    for (s32 i = 0; i < articles; i++) {
+      article_page[i] = load_meta(site, article[i]);
+      ASSERT(article_page[i], "ERR: failed to read %.*s!", (s32) article[i].len, article[i].str);
+    }
+    index_load(site);
+    build_index(site, a, article_page, articles);
+    index_save(site);
+  }
+}
+
+// Writes every page whose source or templates changed since the last call.
+void build_site(Site *site, Arena *a) {
+  if (site->cache.pos > site->cache.size/2) {
+    cache_reset(site);
+  }
+  load_templates(site);
+
+  ARENA_TEMP(*a) {
+    s32 articles;
+    str *article = list_articles(site, a, &articles);
+
+    Cached **article_page = Arena_array(a, Cached*, articles);
+    for (s32 i = 0; i < articles; i++) ARENA_TEMP(*a) {
+      Cached *c = load_page(site, article[i]);
+      ASSERT(c, "ERR: failed to read %.*s!", (s32) article[i].len, article[i].str);
+      article_page[i] = c;
+      if (c->dirty || site->templates_dirty) {
+        str html = render_cached(site, a, c, false);
+        ASSERT(html.str && !emit_page(site, a, (char*) c->out.str, html, true), "ERR: failed to write %s!", c->out.str);
+        c->dirty = false;
+      }
+    }
+
+    index_load(site);
+    build_index(site, a, article_page, articles);
+    index_save(site);
+  }
+
+  {
+    DIR *dir = fdopendir(dup(site->pages));
+    rewinddir(dir);
+    for (struct dirent* f; (f = readdir(dir)); ) ARENA_TEMP(*a) {
+      if (f->d_type != DT_REG) continue;
+
+      Cached *c = load_page(site, strc(f->d_name));
+      if (c && (c->dirty || site->templates_dirty)) {
+        str html = render_cached(site, a, c, false);
+        ASSERT(html.str && !emit_page(site, a, (char*) c->out.str, html, true), "ERR: failed to write %s!", c->out.str);
+        c->dirty = false;
+      }
+    }
+    closedir(dir);
+  }
+
+  site->templates_dirty = false;
+}
+
+s64 now_us(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec*1000000ll + t.tv_nsec/1000;
+}
+
+void daemon_reply(int c, const char *status, s64 start, str payload) {
+  char h[128];
+  s32 n = snprintf(h, sizeof(h), "%s %lld %lld\n", status, (long long) payload.len, (long long) (now_us() - start));
+  write(c, h, n);
+  for (s64 i = 0; i < payload.len; ) {
+    ssize_t w = write(c, payload.str + i, payload.len - i);
+    if (w <= 0) {
+      break;
+    }
+    i += w;
+  }
+}
+
+// reads from c until buf holds at least need bytes, false on EOF
+bool daemon_recv(int c, u8 *buf, s64 *len, s64 cap, s64 need) {
+  while (*len < need) {
+    if (*len >= cap) {
+      return false;
+    }
+    ssize_t n = read(c, buf + *len, cap - *len);
+    if (n <= 0) {
+      return false;
+    }
+    *len += n;
+  }
+  return true;
+}
+
+/* NOTE(lf) Keeps templates and parsed pages resident between requests.
+   Requests are single lines, answered with "<status> <bytes> <usec>\n"
+   followed by <bytes> of payload:
+     render <path>     full html for pages/<path>, re-parsed only if changed
+     rebuild           write changed pages, payload lists what was written
+     index             write blog.html and rss.xml from frontmatter alone
+     markdown <bytes>  render the following markdown as a page
+     article <bytes>   same, with frontmatter and table of contents
+     quit
+   Up to DAEMON_CLIENTS connections are polled, so an editor can stay
+   connected while CI rebuilds. Requests are answered one at a time, and a
+   client that stalls mid payload for DAEMON_TIMEOUT seconds is dropped.
+*/
+#define DAEMON_CLIENTS 16
+#define DAEMON_LINE 4096
+#define DAEMON_TIMEOUT 5
+
+typedef struct DaemonClient DaemonClient;
+struct DaemonClient {
+  int fd;
+  s64 len;
+  u8 line[DAEMON_LINE]; // read but not yet handled
+};
+
+typedef struct Daemon Daemon;
+struct Daemon {
+  Site *site;
+  Arena *a;
+  Arena preview;  // markdown requests, so a preview can't exhaust a
+  u8 *payload;
+  s64 cap;
+  bool running;
+};
+
+// handles the request in cl->line[0..eol), false if cl should be dropped
+bool daemon_request(Daemon *d, DaemonClient *cl, s64 eol) {
+  Site *site = d->site;
+  Arena *a = d->a;
+  int c = cl->fd;
+  str line = str_trim_whitespace((str){ cl->line, eol });
+  str cmd = str_cut_char(&line, ' ');
+  s64 used = eol + 1;
+  s64 start = now_us();
+  bool keep = true;
+
+  ARENA_TEMP(*a) {
+    if (str_eq(cmd, strl("render"))) {
+      // re-parses pile up in the cache between rebuilds, so check here too
+      if (site->cache.pos > site->cache.size/2) {
+        cache_reset(site);
+      }
+      // relative to pages only, as the preview server's fallback is to docs
+      char *name = str_cstring(a, line);
+      bool inside = name[0] != '/' && strstr(name, "..") == 0;
+      Cached *p = inside? load_page(site, line) : 0;
+      if (p) {
+        str html = render_cached(site, a, p, true);
+        daemon_reply(c, html.str? "ok" : "err", start, html);
+      } else {
+        daemon_reply(c, "err", start, strl("no such page\n"));
+      }
+
+    } else if (str_eq(cmd, strl("rebuild"))) {
+      Buf log = {};
+      log.cap = MB(1);
+      log.buf = Arena_bytes(a, log.cap);
+      site->log = &log;
+      build_site(site, a);
+      site->log = 0;
+      daemon_reply(c, "ok", start, (str){ log.buf, log.len });
+
+    } else if (str_eq(cmd, strl("index"))) {
+      Buf log = {};
+      log.cap = MB(1);
+      log.buf = Arena_bytes(a, log.cap);
+      site->log = &log;
+      build_index_only(site, a);
+      site->log = 0;
+      daemon_reply(c, "ok", start, (str){ log.buf, log.len });
+
+    } else if (str_eq(cmd, strl("markdown")) || str_eq(cmd, strl("article"))) {
+      s64 n = atoll(str_cstring(a, line));
+      RenderOptions opt = {
+        .name = strl("preview"),
+        .header = site->header,
+        .footer = site->footer,
+        .article = str_eq(cmd, strl("article")),
+      };
+      bool fits = n >= 0 && n <= d->cap && render_arena_size(n, &opt) <= (s64) d->preview.size;
+      s64 got = 0;
+      if (fits) {
+        // the start of the payload may have been read along with the line
+        got = MIN(n, cl->len - used);
+        memcpy(d->payload, cl->line + used, got);
+        used += got;
+      }
+      if (!fits || !daemon_recv(c, d->payload, &got, n, n)) {
+        // the rest of the stream can't be framed, so drop this client only
+        daemon_reply(c, "err", start, strl("markdown too large\n"));
+        keep = false;
+      } else ARENA_TEMP(d->preview) {
+        str html = render_page(&d->preview, (str){ d->payload, n }, &opt);
+        daemon_reply(c, html.str? "ok" : "err", start, html);
+      }
+
+    } else if (str_eq(cmd, strl("quit"))) {
+      daemon_reply(c, "ok", start, (str){});
+      d->running = false;
+
+    } else {
+      daemon_reply(c, "err", start, strl("unknown request\n"));
+    }
+  }
+
+  memmove(cl->line, cl->line + used, cl->len - used);
+  cl->len -= used;
+  return keep;
+}
+
+// reads what cl has sent and handles every complete request in it
+bool daemon_serve(Daemon *d, DaemonClient *cl) {
+  ssize_t n = read(cl->fd, cl->line + cl->len, DAEMON_LINE - cl->len);
+  if (n <= 0) {
+    return false;
+  }
+  cl->len += n;
+
+  for (s64 eol; d->running && (eol = str_find_char((str){ cl->line, cl->len }, '\n')) >= 0; ) {
+    if (!daemon_request(d, cl, eol)) {
+      return false;
+    }
+  }
+  if (cl->len == DAEMON_LINE) {
+    daemon_reply(cl->fd, "err", now_us(), strl("request too long\n"));
+    return false;
+  }
+  return true;
+}
+
+void run_daemon(Site *site, Arena *a, const char *path) {
+  int s = socket(AF_UNIX, SOCK_STREAM, 0);
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+  unlink(path);
+  ASSERT(bind(s, (struct sockaddr*) &addr, sizeof(addr)) == 0, "ERR: failed to bind %s!", path);
+  ASSERT(listen(s, 16) == 0, "ERR: failed to listen!");
+  signal(SIGPIPE, SIG_IGN);
+
+  Daemon d = { .site = site, .a = a, .cap = MB(8), .running = true };
+  d.payload = Arena_bytes(a, d.cap);
+  d.preview = Arena_alloc((Arena){ .size = MB(256) });
+  DaemonClient *client = Arena_array(a, DaemonClient, DAEMON_CLIENTS);
+  s32 clients = 0;
+
+  struct pollfd fds[1 + DAEMON_CLIENTS];
+  while (d.running) {
+    fds[0] = (struct pollfd){ .fd = s, .events = clients < DAEMON_CLIENTS? POLLIN : 0 };
+    for (s32 i = 0; i < clients; i++) {
+      fds[1 + i] = (struct pollfd){ .fd = client[i].fd, .events = POLLIN };
+    }
+    if (poll(fds, 1 + clients, -1) < 0) {
+      continue;
+    }
+
+    // back to front, so dropping swaps in a client that was already served
+    for (s32 i = clients - 1; i >= 0 && d.running; i--) {
+      if (fds[1 + i].revents && !daemon_serve(&d, &client[i])) {
+        close(client[i].fd);
+        client[i] = client[--clients];
+      }
+    }
+
+    if (fds[0].revents & POLLIN) {
+      int c = accept(s, 0, 0);
+      if (c >= 0) {
+        struct timeval t = { .tv_sec = DAEMON_TIMEOUT };
+        setsockopt(c, SOL_SOCKET, SO_RCVTIMEO, &t, sizeof(t));
+        setsockopt(c, SOL_SOCKET, SO_SNDTIMEO, &t, sizeof(t));
+        client[clients].fd = c;
+        client[clients].len = 0;
+        clients++;
+      }
+    }
+  }
+
+  for (s32 i = 0; i < clients; i++) {
+    close(client[i].fd);
+  }
+  close(s);
+  unlink(path);
+}
+
+#if defined(SITE_FUZZ)
+/* NOTE(lf) Fuzzing the markdown engine, not built by default.
+     clang -g -O1 -fsanitize=fuzzer,address,undefined -DSITE_FUZZ site.c
+     afl-clang-fast -g -fsanitize=address -DSITE_FUZZ -DSITE_FUZZ_MAIN site.c
+   Each input is rendered as a page and as an article, which catches
+   crashes and, with the sanitizers, out of bounds reads. It is then
+   grown FUZZ_REPEAT times over in three ways: the whole input repeated,
+   each line repeated as more lines (longer blocks), and each line
+   repeated along itself (longer lines). Rendering is meant to be linear,
+   so if any of those takes much more than FUZZ_REPEAT times as long, the
+   input aborts as superlinear. Parser warnings go to stderr, so close it when fuzzing
+   (-close_fd_mask=2 for libFuzzer).
+   With SITE_FUZZ_MAIN, `site-fuzz <files>` runs saved inputs, reading
+   stdin when there are none as AFL expects, and `site-fuzz -reduce <out>
+   <file>` shrinks a failing input to a smaller one that still fails.
+   To minimize a corpus, use the fuzzers' own tools on the same entry
+   point: `-merge=1 <out> <corpus>` for libFuzzer or afl-cmin for AFL.
+*/
+#define FUZZ_REPEAT 16
+#define FUZZ_MAX_LEN KB(64)
+
+s64 fuzz_render_us(Arena *a, str md, bool article) {
+  s64 best = 0;
+  for (s32 run = 0; run < 3; run++) ARENA_TEMP(*a) {
+    RenderOptions opt = { .name = strl("fuzz"), .article = article, .max_len = MB(64) };
+    s64 start = now_us();
+    render_page(a, md, &opt);
+    s64 us = now_us() - start;
+    best = run? MIN(best, us) : us;
+  }
+  return best;
+}
+
+// md grown FUZZ_REPEAT times: as a whole, or line by line joined by sep
+str fuzz_grow(Arena *a, str md, bool whole, u8 sep) {
+  str out = str_sized(a, FUZZ_REPEAT*(md.len + 1));
+  out.len = 0;
+  for (str rest = md; rest.len > 0 || out.len == 0; ) {
+    str line = whole? rest : str_cut_char(&rest, '\n');
+    rest = whole? (str){} : rest;
+    for (s32 i = 0; i < FUZZ_REPEAT; i++) {
+      memcpy(out.str + out.len, line.str, line.len);
+      out.len += line.len;
+      out.str[out.len++] = i + 1 < FUZZ_REPEAT? sep : '\n';
+    }
+  }
+  return out;
+}
+
+int LLVMFuzzerTestOneInput(const u8 *data, size_t size) {
+  static Arena a;
+  if (!a.buf) {
+    a = Arena_alloc((Arena){ .size = MB(1024) });
+  }
+  if (size > FUZZ_MAX_LEN) {
+    return 0;
+  }
+
+  ARENA_TEMP(a) {
+    str md = str_sized(&a, size);
+    memcpy(md.str, data, size);
+
+    str grown[3] = {
+      fuzz_grow(&a, md, true, '\n'),
+      fuzz_grow(&a, md, false, '\n'),
+      fuzz_grow(&a, md, false, ' '),
+    };
+
+    for (s32 article = 0; article < 2; article++) {
+      s64 one = fuzz_render_us(&a, md, article);
+      for (s32 i = 0; i < 3; i++) {
+        s64 all = fuzz_render_us(&a, grown[i], article);
+        if (all > 4*FUZZ_REPEAT*one + 5000) {
+          fprintf(stderr, "superlinear: %zu bytes took %lldus, grown %d times (%d) took %lldus\n",
+                  size, (long long) one, FUZZ_REPEAT, i, (long long) all);
+          abort();
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+#if defined(SITE_FUZZ_MAIN)
+#include <sys/wait.h>
+
+// True if md crashes or aborts in a child process.
+bool fuzz_fails(str md) {
+  pid_t pid = fork();
+  if (pid == 0) {
+    int null = open("/dev/null", O_WRONLY);
+    dup2(null, 2);
+    LLVMFuzzerTestOneInput(md.str, md.len);
+    _exit(0);
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  return !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+}
+
+// Removes halves, then quarters and so on of md while it keeps failing.
+str fuzz_reduce(Arena *a, str md) {
+  str out = str_copy(a, md);
+  str try = str_sized(a, md.len);
+  for (s64 chunk = out.len/2; chunk > 0; chunk /= 2) {
+    for (s64 i = 0; i < out.len; ) {
+      s64 cut = MIN(chunk, out.len - i);
+      memcpy(try.str, out.str, i);
+      memcpy(try.str + i, out.str + i + cut, out.len - i - cut);
+      try.len = out.len - cut;
+      if (fuzz_fails(try)) {
+        memcpy(out.str, try.str, try.len);
+        out.len = try.len;
+        fprintf(stderr, "%lld bytes\n", (long long) out.len);
+      } else {
+        i += cut;
+      }
+    }
+  }
+  return out;
+}
+
+int main(int argc, char *argv[]) {
+  Arena a = Arena_alloc((Arena){ .size = MB(256) });
+
+  if (argc == 4 && strcmp(argv[1], "-reduce") == 0) {
+    str md = read_file(&a, AT_FDCWD, argv[3]);
+    ASSERT(fuzz_fails(md), "ERR: %s doesn't fail!", argv[3]);
+    str out = fuzz_reduce(&a, md);
+    return write_filev(AT_FDCWD, argv[2], &out, 1);
+  }
+
+  if (argc == 1) {
+    str md = str_sized(&a, FUZZ_MAX_LEN);
+    md.len = MAX(read(0, md.str, md.len), 0);
+    return LLVMFuzzerTestOneInput(md.str, md.len);
+  }
+
+  for (s32 i = 1; i < argc; i++) ARENA_TEMP(a) {
+    str md = read_file(&a, AT_FDCWD, argv[i]);
+    fprintf(stderr, "%s\n", argv[i]);
+    LLVMFuzzerTestOneInput(md.str, md.len);
+  }
+  return 0;
+}
+#endif // SITE_FUZZ_MAIN
+
+#else
+int main(int argc, char *argv[]) {
+  Arena a = Arena_alloc((Arena){ .size = MB(32) });
+
+  Site site = {};
+  site.pack = -1;
+  site.ast_dir = -1;
+  site.golden = -1;
+
+  char *arg[2] = {};
+  s32 args = 0;
+  for (s32 i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--rss-items") == 0 && i + 1 < argc) {
+      site.rss_items = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--blog-page") == 0 && i + 1 < argc) {
+      site.blog_page = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--minify") == 0) {
+      site.minify = true;
+    } else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc) {
+      mkdir(argv[++i], 0777);
+      site.ast_dir = open(argv[i], O_RDONLY | O_DIRECTORY);
+    } else if (args < 2 && argv[i][0] != '-') {
+      arg[args++] = argv[i];
+    } else {
+      args = -1;
+      break;
+    }
+  }
+
+  bool packing = args > 0 && strcmp(arg[0], "pack") == 0;
+  bool serving = args > 0 && strcmp(arg[0], "serve") == 0;
+  bool daemon = args > 0 && strcmp(arg[0], "daemon") == 0;
+  bool indexing = args > 0 && strcmp(arg[0], "index") == 0;
+  bool checking = args > 0 && strcmp(arg[0], "check") == 0;
+  if (args < 0 || (args > 0 && !packing && !serving && !daemon && !indexing && !checking)) {
+    fprintf(stderr, "usage: site [pack | index | check [golden] | serve [port] | daemon [socket]] [--rss-items N] [--blog-page N] [--minify] [--cache dir]\n");
+    return 1;
+  }
+
+  site.docs = open("docs", O_RDONLY | O_DIRECTORY);
+  ASSERT(site.docs >= 0, "ERR: failed to open docs!");
+
+  if (serving) {
+    serve(&a, site.docs, arg[1]? atoi(arg[1]) : 8000);
+    return 0;
+  }
+
+  site.pages = open("pages", O_RDONLY | O_DIRECTORY);
+  site.writing = openat(site.pages, "writing", O_RDONLY | O_DIRECTORY);
+  ASSERT(site.pages >= 0 && site.writing >= 0, "ERR: failed to open pages!");
+
+  load_templates(&site);
+
+  if (daemon) {
+    run_daemon(&site, &a, arg[1]? arg[1] : "site.sock");
+    return 0;
+  }
+
+  if (indexing) {
+    build_index_only(&site, &a);
+    return 0;
+  }
+
+  if (checking) {
+    // renders everything and compares it with golden/, the committed output
+    // of a plain `site` run. Regenerate it with `site` and copy the pages
+    // from docs/ over when the output is meant to change.
+    char *golden = arg[1]? arg[1] : "golden";
+    site.golden = open(golden, O_RDONLY | O_DIRECTORY);
+    ASSERT(site.golden >= 0, "ERR: failed to open %s!", golden);
+    build_site(&site, &a);
+    return site.mismatches > 0;
+  }
+
+  if (packing) {
+    pack_open(&site, &a);
+  }
+
+  build_site(&site, &a);
+
+  ASSERT(!pack_close(&site), "ERR: failed to write %s!", PACK_NAME);
+
+  return 0;
+}
+#endif // SITE_FUZZ